@@ -1,39 +1,119 @@
+// popen/pclose, sysconf e mmap são POSIX; sem isto -std=c11 não os declara
+#define _POSIX_C_SOURCE 200809L
 #include "raylib.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <assert.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 //====================================================================================
 // DEFINIÇÕES E CONSTANTES GLOBAIS
 //====================================================================================
-#define MAX_NODES 50
 #define NODE_RADIUS 20
-#define MAX_CONNECTIONS 10
-#define MAX_MESSAGES 1000000
+#define MAX_MESSAGES 10000000 // Máximo de mensagens simultâneas (slots alocados)
 #define MESSAGE_SPEED 1.5f
 #define MESSAGE_INTERVAL 0.2f
 #define QUEUE_OFFSET_X 25
+#define MESSAGE_RADIUS 8
+#define MESSAGE_LOD_THRESHOLD 2000 // Acima disso as mensagens viram densidade por ligação
+
+#define ROUTE_CACHE_SIZE 4096 // Entradas do cache de rotas (potência de 2)
+#define ROUTE_TABLE_BUCKETS 1024 // Baldes iniciais da tabela de rotas internadas (potência de 2)
+#define PARALLEL_BATCH_MIN 64    // Chegadas simultâneas mínimas para dividir o lote entre threads
+#define TIMER_TICK_SECONDS (1.0 / 128.0) // Resolução da roda de temporizadores
+#define TIMER_WHEEL_BITS 6                // 64 posições por nível
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+#define LATENCY_SUB_BITS 5 // 32 sub-baldes por potência de 2: erro relativo de até ~3%
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS 40 // Latências acima de 2^40 us (~12 dias simulados) saturam
+#define LATENCY_MAX_MICROS ((1ULL << LATENCY_MAX_BITS) - 1)
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+#define LATENCY_HOP_CLASSES 16 // Caminhos com 16 saltos ou mais ficam na última classe
 
 #define MAX_CAPACITY_PER_LINK 20
-#define TIMEOUT_SECONDS 10.0f
+#define LINK_SAMPLE_SECONDS 1.0 // Período, em tempo simulado, das amostras de uso das arestas
+#define LINK_SAMPLE_COUNT 32    // Amostras guardadas por aresta dirigida
+#define TRACE_RING_RECORDS (1 << 20) // Registros do anel de trace (24 bytes cada)
+#define TRACE_PID_NODES 1            // "Processo" do trace com uma trilha por nó
+#define TRACE_PID_LINKS 2            // "Processo" do trace com uma trilha por aresta dirigida
+#define TRACE_FILE "trace.json"      // Destino do trace ligado pela tecla T
+#define TIMEOUT_SECONDS 60.0f // Prazo inicial e mínimo de retransmissão (ver RetransmissionTimeout)
+#define TIMEOUT_BACKOFF_MAX 6 // O prazo dobra a cada retransmissão, até 2^6 vezes timeoutSeconds
+#define ROUTE_RETRY_BACKOFF_MAX 4 // Revisões da espera por rota sem sucesso espaçam até 2^4 intervalos
+#define TOPOLOGY_SPACING 80.0f       // Distância média entre vizinhos nos layouts gerados
+#define TOPOLOGY_MAX_NODES (1 << 24) // Limite de nós dos geradores de topologia
+#define TOPOLOGY_FILE "topology.bin" // Arquivo das teclas S e L
+#define TOPOLOGY_FILE_MAGIC "NSCTOPO"
+#define TOPOLOGY_FILE_VERSION 1 // Muda junto com o layout binário e com HashEdge
 
 //====================================================================================
 // ESTRUTURAS DE DADOS
 //====================================================================================
 
-typedef struct Network
+// Estado dinâmico de uma aresta dirigida, num único registro por id de aresta:
+// ocupação, capacidade, fila e estatísticas mudam juntos a cada salto. Só a
+// thread do motor escreve aqui; o passo paralelo reserva vagas em edgeLoadDelta.
+typedef struct EdgeState
+{
+  int load;                 // Mensagens percorrendo a aresta; 0 libera a pista oposta
+  int capacity;             // Máximo de mensagens simultâneas
+  int queueHead, queueTail; // Fila FIFO no nó de origem
+  long long messagesCarried;
+  double busySince;         // simTime em que load saiu de zero, ou -1 se ociosa
+  double busySeconds;       // Tempo simulado com load > 0
+  double saturatedSince;    // simTime em que load chegou à capacidade, ou -1
+  double saturatedSeconds;  // Tempo simulado com load == capacity
+  int peakLoad;             // Maior load desde a criação da aresta
+  int intervalPeak;         // Maior load desde a última amostra
+  double sampledBusy, sampledSaturated; // Totais acima na última amostra
+  long long sampledCarried;
+} EdgeState;
+
+// Uso de uma aresta dirigida durante um período LINK_SAMPLE_SECONDS
+typedef struct LinkSample
 {
-  int graph[MAX_NODES][MAX_NODES];
-} Network;
+  float busy;      // Fração do período com load > 0
+  float saturated; // Fração do período com load == capacity
+  int carried;     // Mensagens que entraram na aresta
+  int peak;        // Maior load no período
+} LinkSample;
 typedef struct Node
 {
   float x, y;
   int id;
-  int connections[MAX_CONNECTIONS];
-  int connectionCount;
 } Node;
+
+// Grafo em CSR (compressed sparse row). Cada ligação vira duas arestas
+// dirigidas consecutivas, 2k (a->b) e 2k+1 (b->a), então a pista oposta de 'e'
+// é e ^ 1. As arestas de saída de 'n' são adjEdge[adjOffset[n]..adjOffset[n+1]-1],
+// na ordem em que as ligações foram criadas.
+typedef struct Graph
+{
+  int *edgeFrom, *edgeTo;
+  bool *edgeAlive; // Falso depois que UndoAction remove a ligação; o id não é reutilizado
+  int edgeCount, edgeCapacity;
+  int *adjOffset;  // nodeCount + 1 entradas
+  int *adjEdge;
+  int *adjTarget;  // edgeTo[adjEdge[k]], contíguo para a busca em largura
+  bool dirty;      // Arestas ou nós mudaram desde a última reconstrução do CSR
+  unsigned int version; // Incrementada a cada mudança de nós ou ligações (camada de topologia)
+  int *edgeIndex;  // Endereçamento aberto (origem, destino) -> id da aresta mais recente
+  int edgeIndexCapacity;
+} Graph;
 typedef enum MsgState
 {
   SENDING,
@@ -42,17 +122,170 @@ typedef enum MsgState
   QUEUED
 } MsgState;
 
-typedef struct AsyncMessage
+// Papel do nó para uma mensagem parada nele
+typedef enum QueueKind
+{
+  QUEUE_ORIGIN,       // Esperando para sair da origem
+  QUEUE_ACK,          // ACK esperando para sair do destino
+  QUEUE_INTERMEDIATE, // No meio do caminho, ida ou ACK
+  QUEUE_KIND_COUNT
+} QueueKind;
+
+// Armazenamento das mensagens em colunas (estrutura de arrays), indexadas pelo
+// slot da mensagem. As colunas quentes são as únicas lidas pelos laços de
+// eventos e de desenho; rotas, tempos e contadores ficam em colunas frias.
+typedef struct MessageStore
+{
+  int capacity;  // Slots alocados em cada coluna
+  int slotCount; // Slots já usados ao menos uma vez
+  int freeHead;  // Lista livre encadeada por queueNext
+
+  // --- Colunas quentes ---
+  unsigned char *state;         // MsgState
+  double *segmentStartTime;     // Tempo simulado em que o segmento atual começou a ser percorrido
+  int *segmentEdge;             // Aresta do segmento atual (SENDING/ACK_RECEIVING)
+  int *currentSegment, *currentAckSegment;
+  unsigned int *sendEpoch;      // Invalida eventos pendentes após timeout ou conclusão
+
+  // --- Colunas de fila ---
+  int *queuedAtNodeId;
+  int *queuedEdge;              // Aresta de saída aguardada, ou -1 na espera por rota
+  int *queuePrev, *queueNext;   // Lista encadeada da fila do enlace (ou lista livre de slots)
+  unsigned long long *queueSeq; // Ordem de chegada na fila, para FIFO entre os enlaces do nó
+
+  // --- Colunas frias ---
+  int *from, *to;
+  int *route, *ackRoute;        // Rotas internadas (ida e ACK), ou -1; ackRoute só existe após sair do destino
+  unsigned int *routeEpochSeen; // routeEpoch do último cálculo de rota na origem ou no destino
+  int *timeoutTimer;            // Temporizador de RetransmissionTimeout armado no envio, ou -1
+  unsigned int *generation;     // Incrementada a cada liberação do slot
+  int *activeIndex;             // Posição em activeMessages, ou -1 depois de DONE
+  double *creation_time;        // Tempo simulado (simTime) da criação
+  double *sendTime;             // Tempo simulado da última saída da origem (amostra de RTT)
+  int *retransmission_count;
+} MessageStore;
+
+// Caminho guardado uma única vez e compartilhado por todas as mensagens que o usam
+typedef struct Route
+{
+  int *hops;     // Nós do caminho, do início ao destino
+  int length;
+  int refCount;  // Mensagens e entradas do cache que apontam para a rota
+  unsigned int hash;
+  int next;      // Próxima rota no mesmo balde (ou na lista livre)
+} Route;
+
+typedef struct RouteTable
+{
+  Route *routes;
+  int capacity, used, freeHead;
+  int count; // Rotas vivas
+  int *buckets;
+  int bucketCount;
+} RouteTable;
+
+// Resultado memoizado da busca para um par (início, destino)
+typedef struct RouteCacheEntry
+{
+  int start, goal;
+  unsigned int epoch; // routeEpoch em que a rota foi calculada
+  int route;          // Rota internada (a entrada detém uma referência), ou -1 sem caminho
+} RouteCacheEntry;
+
+// Referência estável a uma mensagem: deixa de ser válida quando o slot é reciclado
+typedef struct MessageHandle
+{
+  int index;
+  unsigned int generation;
+} MessageHandle;
+
+#define INVALID_MESSAGE_HANDLE ((MessageHandle){-1, 0})
+
+// Eventos do escalonador, ordenados por tempo simulado
+typedef enum EventType
+{
+  EVENT_HOP_ARRIVAL,  // Mensagem (ou ACK) chega ao fim do segmento atual
+  EVENT_NODE_RELEASE  // Nó pode tentar liberar uma mensagem enfileirada
+} EventType;
+
+typedef struct SimEvent
+{
+  double time;
+  unsigned long long seq; // Desempate determinístico entre eventos no mesmo instante
+  EventType type;
+  int id;             // Índice da mensagem ou do nó
+  unsigned int stamp; // sendEpoch da mensagem quando o evento foi agendado
+} SimEvent;
+
+// Tipos de temporizador da roda; o callback de disparo decide o que fazer com 'id'
+typedef enum TimerKind
+{
+  TIMER_MESSAGE_TIMEOUT // Prazo de RetransmissionTimeout desde o envio na origem
+} TimerKind;
+
+typedef struct Timer
+{
+  long long expiryTick;
+  int prev, next; // Lista duplamente encadeada da posição (ou lista livre)
+  int slot;       // nível * TIMER_WHEEL_SLOTS + posição, ou -1 se livre
+  TimerKind kind;
+  int id;
+} Timer;
+
+typedef void (*TimerCallback)(TimerKind kind, int id);
+
+// Roda hierárquica: armar, cancelar e disparar custam O(1) por temporizador
+typedef struct TimerWheel
+{
+  Timer *timers;
+  int capacity, used, freeHead;
+  int count; // Temporizadores armados
+  long long currentTick;
+  int slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TimerWheel;
+
+typedef struct EventQueue
+{
+  SimEvent *items; // Heap binário mínimo
+  int count, capacity;
+  unsigned long long nextSeq;
+} EventQueue;
+
+typedef struct LatencyHistogram
+{
+  long long counts[LATENCY_BUCKETS];
+  long long total;
+  unsigned long long maxMicros;
+} LatencyHistogram;
+
+// Entrada da tabela de histogramas por fluxo (hist == NULL marca posição livre)
+typedef struct FlowLatency
 {
   int from, to;
-  MsgState state;
-  float progress;
-  int currentSegment, path[MAX_NODES], pathLength;
-  int currentAckSegment, ackPath[MAX_NODES], ackPathLength;
-  int queuedAtNodeId;
-  clock_t creation_time, last_sent_time, completion_time;
-  int retransmission_count;
-} AsyncMessage;
+  LatencyHistogram *hist;
+} FlowLatency;
+
+typedef enum TraceKind
+{
+  TRACE_CREATED,       // where = origem
+  TRACE_SEGMENT_START, // where = aresta
+  TRACE_SEGMENT_END,   // where = aresta
+  TRACE_QUEUED,        // where = nó
+  TRACE_DEQUEUED,      // where = nó
+  TRACE_TIMEOUT,       // where = origem
+  TRACE_DONE,          // where = origem
+  TRACE_DROPPED        // where = origem
+} TraceKind;
+
+typedef struct TraceRecord
+{
+  double time; // simTime
+  int message;
+  int where;   // Nó ou aresta, conforme kind
+  unsigned char kind; // TraceKind
+  unsigned char ack;  // Trecho de volta
+  unsigned short hop; // Segmento da rota do trecho
+} TraceRecord;
 
 typedef enum ActionType
 {
@@ -68,26 +301,607 @@ typedef struct Action
 //====================================================================================
 // VARIÁVEIS GLOBAIS
 //====================================================================================
-Node nodes[MAX_NODES];
+Node *nodes = NULL;
 int nodeCount = 0;
-AsyncMessage messages[MAX_MESSAGES];
-int messageCount = 0;
+int nodeCapacity = 0; // Entradas alocadas em nodes e nas colunas por nó
+Graph graph = {.version = 1};
+// Slots de mensagens, alocados sob demanda até o pico de concorrência e
+// reciclados por uma lista livre quando a mensagem chega em DONE
+MessageStore msgs = {.freeHead = -1};
+int sent_messages_count = 0;
 
-// --- DUAS REDES SEPARADAS PARA CONTROLE ---
-Network pathfindingNetwork; // Para BuildPath usar a regra da pista oposta == 0
-Network capacityNetwork;    // Para contar mensagens e checar capacidade
+// Índice denso das mensagens não concluídas (SENDING, ACK_RECEIVING, QUEUED),
+// mantido com remoção por troca para que o custo acompanhe o tráfego em curso
+int *activeMessages = NULL;
+int activeCount = 0;
+
+// --- ESTADO DAS ARESTAS ---
+// Ocupação usada tanto pela regra da pista oposta quanto pela capacidade
+EdgeState *edgeState = NULL;
+// Variação de load de cada aresta durante um lote do passo paralelo, onde os
+// workers liberam e reservam com CAS. RunHopBatch a soma em load e zera; fora
+// dos lotes é sempre 0.
+_Atomic int *edgeLoadDelta = NULL;
+// Anéis de LINK_SAMPLE_COUNT amostras por aresta, todos na mesma posição:
+// a amostra 'age' da aresta e fica em linkSamples[e * LINK_SAMPLE_COUNT + slot]
+LinkSample *linkSamples = NULL;
+int linkSampleHead = 0;      // Posição da próxima amostra
+int linkSampleCount = 0;     // Amostras válidas, até LINK_SAMPLE_COUNT
+unsigned int linkSampleSerial = 0; // Muda a cada amostra
+double nextLinkSampleTime = LINK_SAMPLE_SECONDS;
 
 Action actionStack[100];
 int actionTop = -1;
 
-long long total_latency_ticks = 0;
+double total_latency_seconds = 0.0; // Soma das latências em tempo simulado
+LatencyHistogram latencyHistogram;   // Todas as mensagens concluídas
+// Quebras opcionais (--latency-breakdown no modo headless), alocadas sob demanda
+bool latencyBreakdown = false;
+LatencyHistogram *latencyByHops[LATENCY_HOP_CLASSES]; // Índice = saltos do caminho de ida - 1
+FlowLatency *flowLatency = NULL;                      // Endereçamento aberto por (from, to)
+int flowLatencyCapacity = 0, flowLatencyCount = 0;
+
+TraceRecord *traceRing = NULL; // NULL = rastreamento desligado
+int traceCapacity = 0;          // Potência de 2
+long long traceWritten = 0;     // Registros gravados desde StartTrace; o anel guarda os últimos traceCapacity
 int completed_messages_count = 0;
 int total_retransmissions = 0;
 
+// Parâmetros do motor: começam nas constantes e o modo headless pode trocá-los
+// (--capacity, --speed, --timeout), o que permite varrê-los sem recompilar
+int linkCapacity = MAX_CAPACITY_PER_LINK;
+float messageSpeed = MESSAGE_SPEED;
+float timeoutSeconds = TIMEOUT_SECONDS; // Prazo inicial e mínimo de retransmissão
+
+// Estimativa de RTT de Jacobson/Karels sobre as mensagens concluídas, medida
+// desde a última saída da origem; rttSmoothed < 0 enquanto não há amostra
+double rttSmoothed = -1.0, rttVariance = 0.0;
+
+bool logTimeouts = true; // Imprime cada timeout no console (desligado no modo headless)
+
+// Medição opcional da velocidade do motor em tempo real (não afeta a simulação)
+double engine_wall_seconds = 0.0;
+long long engine_events_processed = 0;
+
+// --- ESCALONADOR DE EVENTOS ---
+EventQueue eventQueue;
+TimerWheel timerWheel;
+double simTime = 0.0;                      // Relógio da simulação, avançado por UpdateAsyncMessages
+float releaseInterval = 0.1f;              // Intervalo mínimo entre liberações de um mesmo nó
+double *nodeReleaseReadyTime = NULL;       // Instante a partir do qual o nó pode liberar de novo
+bool *nodeReleasePending = NULL;           // Já existe EVENT_NODE_RELEASE agendado para o nó
+bool routesChanged = false;                // A ocupação de alguma aresta cruzou zero
+
+// --- FILAS POR ENLACE ---
+// Cada aresta tem uma fila FIFO no nó de origem (em edgeState); mensagens sem
+// rota esperam na lista de espera por rota do nó até routeEpoch mudar
+int *routeWaitHead = NULL, *routeWaitTail = NULL;
+int *nodeQueuedCount = NULL;             // Total de mensagens paradas no nó
+int (*nodeQueuedByKind)[QUEUE_KIND_COUNT] = NULL; // O mesmo total separado por QueueKind
+int queuedByKind[QUEUE_KIND_COUNT];      // Soma de nodeQueuedByKind sobre todos os nós
+unsigned int *nodeRouteEpochSeen = NULL; // routeEpoch da última revisão da espera por rota
+double *nodeRouteRetryTime = NULL;       // Próxima revisão permitida da espera por rota
+unsigned char *nodeRouteRetryBackoff = NULL; // Revisões seguidas que não liberaram nenhuma mensagem
+int *routeWaitNodes = NULL, routeWaitNodeCount = 0; // Nós com espera por rota não vazia
+int *routeWaitNodeIndex = NULL;
+int routeWaitCount = 0; // Mensagens na espera por rota, somando todos os nós
+
+// Vetores de trabalho da busca em largura, do tamanho de nodeCapacity
+unsigned int *searchVisited = NULL, searchStamp = 0;
+int *searchParent = NULL, *searchQueue = NULL, *searchPath = NULL;
+unsigned long long nextQueueSeq = 0;
+
+// --- TABELA DE ROTAS ---
+RouteTable routeTable = {.freeHead = -1};
+
+// --- CACHE DE ROTAS ---
+// routeEpoch muda quando a topologia muda ou uma aresta esvazia, os únicos
+// eventos que podem criar caminhos novos; uma aresta que passa a ser ocupada só
+// pode bloquear rotas, e isso AcquireRoute confere na própria rota
+RouteCacheEntry routeCache[ROUTE_CACHE_SIZE];
+unsigned int routeEpoch = 1;
+long long route_cache_hits = 0, route_cache_misses = 0;
+
+//====================================================================================
+// RODA DE TEMPORIZADORES
+//====================================================================================
+
+void ResetTimerWheel(TimerWheel *w)
+{
+  w->used = 0;
+  w->freeHead = -1;
+  w->count = 0;
+  w->currentTick = 0;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++)
+      w->slots[level][i] = -1;
+}
+
+static void LinkTimer(TimerWheel *w, int t)
+{
+  Timer *timer = &w->timers[t];
+  long long delta = timer->expiryTick - w->currentTick;
+  long long tick = timer->expiryTick;
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1LL << (TIMER_WHEEL_BITS * (level + 1))))
+    level++;
+  long long range = 1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+  if (delta >= range) // Além do alcance: estaciona no último nível e é reavaliado no cascateamento
+    tick = w->currentTick + range - 1;
+  int index = (int)((tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+  timer->slot = level * TIMER_WHEEL_SLOTS + index;
+  timer->prev = -1;
+  timer->next = w->slots[level][index];
+  if (timer->next != -1)
+    w->timers[timer->next].prev = t;
+  w->slots[level][index] = t;
+}
+
+static void UnlinkTimer(TimerWheel *w, int t)
+{
+  Timer *timer = &w->timers[t];
+  int level = timer->slot / TIMER_WHEEL_SLOTS, index = timer->slot % TIMER_WHEEL_SLOTS;
+  if (timer->prev != -1)
+    w->timers[timer->prev].next = timer->next;
+  else
+    w->slots[level][index] = timer->next;
+  if (timer->next != -1)
+    w->timers[timer->next].prev = timer->prev;
+}
+
+static void FreeTimer(TimerWheel *w, int t)
+{
+  w->timers[t].slot = -1;
+  w->timers[t].next = w->freeHead;
+  w->freeHead = t;
+  w->count--;
+}
+
+// Arma um temporizador que vence 'delay' segundos após 'now' (arredondado para
+// o próximo tick) e retorna seu índice para CancelTimer.
+int ArmTimer(TimerWheel *w, double now, double delay, TimerKind kind, int id)
+{
+  // Roda vazia: alinha o tick atual ao relógio em vez de percorrer ticks antigos
+  if (w->count == 0)
+    w->currentTick = (long long)floor(now / TIMER_TICK_SECONDS);
+  int t = w->freeHead;
+  if (t != -1)
+    w->freeHead = w->timers[t].next;
+  else
+  {
+    if (w->used >= w->capacity)
+    {
+      int newCapacity = w->capacity ? w->capacity * 2 : 1024;
+      Timer *timers = realloc(w->timers, newCapacity * sizeof(Timer));
+      if (timers == NULL)
+      {
+        fprintf(stderr, "Sem memoria para os temporizadores\n");
+        exit(1);
+      }
+      w->timers = timers;
+      w->capacity = newCapacity;
+    }
+    t = w->used++;
+  }
+  long long tick = (long long)ceil((now + delay) / TIMER_TICK_SECONDS);
+  if (tick <= w->currentTick)
+    tick = w->currentTick + 1;
+  w->timers[t] = (Timer){.expiryTick = tick, .kind = kind, .id = id};
+  LinkTimer(w, t);
+  w->count++;
+  return t;
+}
+
+void CancelTimer(TimerWheel *w, int t)
+{
+  if (t < 0 || w->timers[t].slot == -1)
+    return;
+  UnlinkTimer(w, t);
+  FreeTimer(w, t);
+}
+
+// Redistribui uma posição de nível superior pelos níveis inferiores.
+static void CascadeTimers(TimerWheel *w, int level, int index)
+{
+  int t = w->slots[level][index];
+  w->slots[level][index] = -1;
+  while (t != -1)
+  {
+    int next = w->timers[t].next;
+    LinkTimer(w, t);
+    t = next;
+  }
+}
+
+// Avança a roda um tick e dispara, em lote, todos os temporizadores vencidos.
+void AdvanceTimerWheel(TimerWheel *w, TimerCallback fire)
+{
+  long long tick = ++w->currentTick;
+  // Cascateia do nível mais alto para o mais baixo cujas posições viram neste tick
+  for (int level = TIMER_WHEEL_LEVELS - 1; level >= 1; level--)
+    if ((tick & ((1LL << (TIMER_WHEEL_BITS * level)) - 1)) == 0)
+      CascadeTimers(w, level, (int)((tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)));
+  int index = (int)(tick & (TIMER_WHEEL_SLOTS - 1));
+  int t = w->slots[0][index];
+  w->slots[0][index] = -1;
+  while (t != -1)
+  {
+    int next = w->timers[t].next;
+    TimerKind kind = w->timers[t].kind;
+    int id = w->timers[t].id;
+    FreeTimer(w, t);
+    fire(kind, id);
+    t = next;
+  }
+}
+
+// Tempo do próximo tick em que algum temporizador pode vencer (limite inferior
+// quando o próximo vencimento ainda está nos níveis superiores), ou -1 se vazia.
+double NextTimerTime(const TimerWheel *w)
+{
+  if (w->count == 0)
+    return -1.0;
+  for (int i = 1; i <= TIMER_WHEEL_SLOTS; i++)
+  {
+    long long tick = w->currentTick + i;
+    if (w->slots[0][tick & (TIMER_WHEEL_SLOTS - 1)] != -1)
+      return tick * TIMER_TICK_SECONDS;
+    if ((tick & (TIMER_WHEEL_SLOTS - 1)) == 0)
+      return tick * TIMER_TICK_SECONDS; // Próximo cascateamento
+  }
+  return (w->currentTick + 1) * TIMER_TICK_SECONDS;
+}
+
+//====================================================================================
+// ESCALONADOR DE EVENTOS
+//====================================================================================
+
+static bool EventBefore(const SimEvent *a, const SimEvent *b)
+{
+  if (a->time != b->time)
+    return a->time < b->time;
+  return a->seq < b->seq;
+}
+
+void ScheduleEvent(double time, EventType type, int id, unsigned int stamp)
+{
+  EventQueue *q = &eventQueue;
+  if (q->count >= q->capacity)
+  {
+    int newCapacity = q->capacity ? q->capacity * 2 : 1024;
+    SimEvent *items = realloc(q->items, newCapacity * sizeof(SimEvent));
+    if (items == NULL)
+    {
+      fprintf(stderr, "Sem memoria para a fila de eventos\n");
+      exit(1);
+    }
+    q->items = items;
+    q->capacity = newCapacity;
+  }
+  int i = q->count++;
+  q->items[i] = (SimEvent){time, q->nextSeq++, type, id, stamp};
+  while (i > 0)
+  {
+    int parent = (i - 1) / 2;
+    if (!EventBefore(&q->items[i], &q->items[parent]))
+      break;
+    SimEvent tmp = q->items[i];
+    q->items[i] = q->items[parent];
+    q->items[parent] = tmp;
+    i = parent;
+  }
+}
+
+SimEvent PopEvent(void)
+{
+  EventQueue *q = &eventQueue;
+  SimEvent top = q->items[0];
+  q->items[0] = q->items[--q->count];
+  int i = 0;
+  while (1)
+  {
+    int left = 2 * i + 1, right = left + 1, smallest = i;
+    if (left < q->count && EventBefore(&q->items[left], &q->items[smallest]))
+      smallest = left;
+    if (right < q->count && EventBefore(&q->items[right], &q->items[smallest]))
+      smallest = right;
+    if (smallest == i)
+      break;
+    SimEvent tmp = q->items[i];
+    q->items[i] = q->items[smallest];
+    q->items[smallest] = tmp;
+    i = smallest;
+  }
+  return top;
+}
+
+bool HasPendingEvents(void)
+{
+  return eventQueue.count > 0 || timerWheel.count > 0;
+}
+
+// Tempo do próximo evento ou temporizador, ou -1 se não houver nenhum pendente.
+double NextEventTime(void)
+{
+  double next = NextTimerTime(&timerWheel);
+  if (eventQueue.count > 0 && (next < 0.0 || eventQueue.items[0].time < next))
+    next = eventQueue.items[0].time;
+  return next;
+}
+
+void ResetRouteTable(void);
+void InitNodeState(int nodeId);
+void InitEdgeState(int edge);
+
+void ResetScheduler(void)
+{
+  activeCount = 0;
+  msgs.slotCount = 0;
+  msgs.freeHead = -1;
+  sent_messages_count = 0;
+  route_cache_hits = route_cache_misses = 0;
+  routeEpoch++;
+  ResetRouteTable();
+  eventQueue.count = 0;
+  eventQueue.nextSeq = 0;
+  ResetTimerWheel(&timerWheel);
+  simTime = 0.0;
+  routesChanged = false;
+  routeWaitNodeCount = 0;
+  routeWaitCount = 0;
+  nextQueueSeq = 0;
+  memset(queuedByKind, 0, sizeof(queuedByKind));
+  linkSampleHead = linkSampleCount = 0;
+  nextLinkSampleTime = LINK_SAMPLE_SECONDS;
+  traceWritten = 0; // Os ids de mensagem recomeçam; registros antigos não se emparelham mais
+  // As filas foram descartadas junto com as mensagens, inclusive as de nós que
+  // ClearGraph já tirou de nodeCount e que AddNode vai reaproveitar
+  for (int i = 0; i < nodeCapacity; i++)
+    nodeQueuedCount[i] = 0;
+  for (int i = 0; i < nodeCount; i++)
+    InitNodeState(i);
+  for (int e = 0; e < graph.edgeCount; e++)
+    InitEdgeState(e);
+}
+
 //====================================================================================
 // FUNÇÕES DE GERENCIAMENTO DA REDE
 //====================================================================================
 
+static void *GrowColumn(void *column, size_t elementSize, int capacity)
+{
+  void *grown = realloc(column, elementSize * capacity);
+  if (grown == NULL)
+  {
+    fprintf(stderr, "Sem memoria\n");
+    exit(1);
+  }
+  return grown;
+}
+
+// Invalida as respostas "sem caminho" memoizadas e acorda as mensagens que esperam por rota.
+void InvalidateRoutes(void)
+{
+  routeEpoch++;
+  routesChanged = true;
+}
+
+void GrowNodeArrays(int capacity)
+{
+  nodes = GrowColumn(nodes, sizeof(*nodes), capacity);
+  nodeReleaseReadyTime = GrowColumn(nodeReleaseReadyTime, sizeof(*nodeReleaseReadyTime), capacity);
+  nodeReleasePending = GrowColumn(nodeReleasePending, sizeof(*nodeReleasePending), capacity);
+  routeWaitHead = GrowColumn(routeWaitHead, sizeof(*routeWaitHead), capacity);
+  routeWaitTail = GrowColumn(routeWaitTail, sizeof(*routeWaitTail), capacity);
+  nodeQueuedCount = GrowColumn(nodeQueuedCount, sizeof(*nodeQueuedCount), capacity);
+  nodeQueuedByKind = GrowColumn(nodeQueuedByKind, sizeof(*nodeQueuedByKind), capacity);
+  nodeRouteEpochSeen = GrowColumn(nodeRouteEpochSeen, sizeof(*nodeRouteEpochSeen), capacity);
+  nodeRouteRetryTime = GrowColumn(nodeRouteRetryTime, sizeof(*nodeRouteRetryTime), capacity);
+  nodeRouteRetryBackoff = GrowColumn(nodeRouteRetryBackoff, sizeof(*nodeRouteRetryBackoff), capacity);
+  routeWaitNodes = GrowColumn(routeWaitNodes, sizeof(*routeWaitNodes), capacity);
+  routeWaitNodeIndex = GrowColumn(routeWaitNodeIndex, sizeof(*routeWaitNodeIndex), capacity);
+  graph.adjOffset = GrowColumn(graph.adjOffset, sizeof(*graph.adjOffset), capacity + 1);
+  searchVisited = GrowColumn(searchVisited, sizeof(*searchVisited), capacity);
+  searchParent = GrowColumn(searchParent, sizeof(*searchParent), capacity);
+  searchQueue = GrowColumn(searchQueue, sizeof(*searchQueue), capacity);
+  searchPath = GrowColumn(searchPath, sizeof(*searchPath), capacity);
+  for (int i = nodeCapacity; i < capacity; i++)
+  {
+    searchVisited[i] = 0;
+    nodeQueuedCount[i] = 0;
+  }
+  nodeCapacity = capacity;
+}
+
+void InitNodeState(int nodeId)
+{
+  // Um índice reutilizado (AddNode depois de UndoAction) não pode herdar filas
+  assert(nodeQueuedCount[nodeId] == 0);
+  nodeReleaseReadyTime[nodeId] = 0.0;
+  nodeReleasePending[nodeId] = false;
+  routeWaitHead[nodeId] = routeWaitTail[nodeId] = -1;
+  nodeQueuedCount[nodeId] = 0;
+  for (int kind = 0; kind < QUEUE_KIND_COUNT; kind++)
+    nodeQueuedByKind[nodeId][kind] = 0;
+  nodeRouteEpochSeen[nodeId] = 0;
+  nodeRouteRetryTime[nodeId] = 0.0;
+  nodeRouteRetryBackoff[nodeId] = 0;
+  routeWaitNodeIndex[nodeId] = -1;
+}
+
+void GrowEdgeArrays(int capacity)
+{
+  graph.edgeFrom = GrowColumn(graph.edgeFrom, sizeof(*graph.edgeFrom), capacity);
+  graph.edgeTo = GrowColumn(graph.edgeTo, sizeof(*graph.edgeTo), capacity);
+  graph.edgeAlive = GrowColumn(graph.edgeAlive, sizeof(*graph.edgeAlive), capacity);
+  graph.adjEdge = GrowColumn(graph.adjEdge, sizeof(*graph.adjEdge), capacity);
+  graph.adjTarget = GrowColumn(graph.adjTarget, sizeof(*graph.adjTarget), capacity);
+  edgeState = GrowColumn(edgeState, sizeof(*edgeState), capacity);
+  edgeLoadDelta = GrowColumn(edgeLoadDelta, sizeof(*edgeLoadDelta), capacity);
+  linkSamples = GrowColumn(linkSamples, sizeof(*linkSamples) * LINK_SAMPLE_COUNT, capacity);
+  graph.edgeCapacity = capacity;
+}
+
+EdgeState IdleEdgeState(int capacity)
+{
+  return (EdgeState){
+      .capacity = capacity,
+      .queueHead = -1,
+      .queueTail = -1,
+      .busySince = -1.0,
+      .saturatedSince = -1.0,
+  };
+}
+
+void InitEdgeState(int edge)
+{
+  edgeState[edge] = IdleEdgeState(linkCapacity);
+  atomic_init(&edgeLoadDelta[edge], 0);
+  memset(&linkSamples[edge * LINK_SAMPLE_COUNT], 0, LINK_SAMPLE_COUNT * sizeof(*linkSamples));
+}
+
+// Usa os bits altos do produto de 64 bits: o índice é mascarado pelos bits
+// baixos, que num produto simples dependem só dos bits baixos de a e b e
+// agrupavam as arestas de ids consecutivos.
+static unsigned int HashEdge(int a, int b)
+{
+  uint64_t key = ((uint64_t)(unsigned int)a << 32) | (unsigned int)b;
+  return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+// Grava a aresta 'e' num índice de 'capacity' posições sobre as colunas
+// from/to, sobrescrevendo uma aresta morta com o mesmo par.
+static void InsertEdgeIndex(int *index, int capacity, const int *from, const int *to, int e)
+{
+  int mask = capacity - 1;
+  int a = from[e], b = to[e];
+  int i = HashEdge(a, b) & mask;
+  while (index[i] != -1)
+  {
+    int other = index[i];
+    if (from[other] == a && to[other] == b)
+      break;
+    i = (i + 1) & mask;
+  }
+  index[i] = e;
+}
+
+static void IndexEdge(int e)
+{
+  InsertEdgeIndex(graph.edgeIndex, graph.edgeIndexCapacity, graph.edgeFrom, graph.edgeTo, e);
+}
+
+static void GrowEdgeIndex(int capacity)
+{
+  free(graph.edgeIndex);
+  graph.edgeIndex = GrowColumn(NULL, sizeof(int), capacity);
+  graph.edgeIndexCapacity = capacity;
+  for (int i = 0; i < capacity; i++)
+    graph.edgeIndex[i] = -1;
+  for (int e = 0; e < graph.edgeCount; e++)
+    if (graph.edgeAlive[e])
+      IndexEdge(e);
+}
+
+// Id da aresta viva a->b, ou -1 se os nós não estão ligados.
+int FindEdge(int a, int b)
+{
+  if (graph.edgeIndexCapacity == 0)
+    return -1;
+  int mask = graph.edgeIndexCapacity - 1;
+  for (int i = HashEdge(a, b) & mask; graph.edgeIndex[i] != -1; i = (i + 1) & mask)
+  {
+    int e = graph.edgeIndex[i];
+    if (graph.edgeFrom[e] == a && graph.edgeTo[e] == b)
+      return graph.edgeAlive[e] ? e : -1;
+  }
+  return -1;
+}
+
+// Remonta o CSR a partir da lista de arestas vivas, com contagem por nó de
+// origem; a ordem dentro de cada nó segue o id da aresta.
+void RebuildAdjacency(void)
+{
+  for (int i = 0; i <= nodeCount; i++)
+    graph.adjOffset[i] = 0;
+  for (int e = 0; e < graph.edgeCount; e++)
+    if (graph.edgeAlive[e])
+      graph.adjOffset[graph.edgeFrom[e] + 1]++;
+  for (int i = 0; i < nodeCount; i++)
+    graph.adjOffset[i + 1] += graph.adjOffset[i];
+  for (int e = 0; e < graph.edgeCount; e++)
+  {
+    if (!graph.edgeAlive[e])
+      continue;
+    int k = graph.adjOffset[graph.edgeFrom[e]]++;
+    graph.adjEdge[k] = e;
+    graph.adjTarget[k] = graph.edgeTo[e];
+  }
+  // O laço acima avançou cada início até o início do nó seguinte
+  for (int i = nodeCount; i > 0; i--)
+    graph.adjOffset[i] = graph.adjOffset[i - 1];
+  graph.adjOffset[0] = 0;
+  graph.dirty = false;
+}
+
+void MarkTopologyChanged(void)
+{
+  graph.dirty = true;
+  graph.version++;
+  routeEpoch++;
+  // Ligações novas podem abrir caminho já: a espera por rota volta a ser revista sem atraso
+  for (int i = 0; i < routeWaitNodeCount; i++)
+  {
+    nodeRouteRetryTime[routeWaitNodes[i]] = 0.0;
+    nodeRouteRetryBackoff[routeWaitNodes[i]] = 0;
+  }
+}
+
+// O CSR é reconstruído sob demanda, então editar muitas ligações seguidas custa O(E) uma vez só.
+void EnsureAdjacency(void)
+{
+  if (graph.dirty)
+    RebuildAdjacency();
+}
+
+void ClearGraph(void)
+{
+  nodeCount = 0;
+  graph.edgeCount = 0;
+  MarkTopologyChanged();
+  for (int i = 0; i < graph.edgeIndexCapacity; i++)
+    graph.edgeIndex[i] = -1;
+}
+
+static void AddEdge(int a, int b)
+{
+  int e = graph.edgeCount++;
+  graph.edgeFrom[e] = a;
+  graph.edgeTo[e] = b;
+  graph.edgeAlive[e] = true;
+  InitEdgeState(e);
+  IndexEdge(e);
+}
+
+void MoveQueue(int id, int edge);
+void WakeNode(int nodeId);
+void DropMessagesAtNode(int nodeId);
+
+// Remove a ligação da aresta 'e' (e da pista oposta). Mensagens que aguardavam
+// essas arestas passam para a espera por rota do nó.
+static void RemoveLink(int e)
+{
+  for (int side = 0; side < 2; side++)
+  {
+    int edge = e ^ side;
+    graph.edgeAlive[edge] = false;
+    while (edgeState[edge].queueHead != -1)
+      MoveQueue(edgeState[edge].queueHead, -1);
+    WakeNode(graph.edgeFrom[edge]);
+  }
+  MarkTopologyChanged();
+}
+
 void PushAction(ActionType type, int a, int b)
 {
   if (actionTop < 99)
@@ -102,136 +916,369 @@ void UndoAction()
   if (actionTop < 0)
     return;
   Action act = actionStack[actionTop--];
+  InvalidateRoutes();
   if (act.type == ACTION_ADD_NODE)
   {
     if (nodeCount > 0)
+    {
+      int removed = nodeCount - 1;
+      for (int e = 0; e < graph.edgeCount; e += 2)
+        if (graph.edgeAlive[e] && (graph.edgeFrom[e] == removed || graph.edgeTo[e] == removed))
+          RemoveLink(e);
+      // Com as ligações já removidas, as mensagens reencaminhadas não passam mais pelo nó
+      DropMessagesAtNode(removed);
       nodeCount--;
+      MarkTopologyChanged();
+    }
   }
   else if (act.type == ACTION_CONNECT_NODES)
   {
-    int a = act.nodeA;
-    int b = act.nodeB;
-    for (int i = 0; i < nodes[a].connectionCount; i++)
-    {
-      if (nodes[a].connections[i] == b)
-      {
-        for (int j = i; j < nodes[a].connectionCount - 1; j++)
-          nodes[a].connections[j] = nodes[a].connections[j + 1];
-        nodes[a].connectionCount--;
-        break;
-      }
-    }
-    for (int i = 0; i < nodes[b].connectionCount; i++)
-    {
-      if (nodes[b].connections[i] == a)
-      {
-        for (int j = i; j < nodes[b].connectionCount - 1; j++)
-          nodes[b].connections[j] = nodes[b].connections[j + 1];
-        nodes[b].connectionCount--;
-        break;
-      }
-    }
+    int e = FindEdge(act.nodeA, act.nodeB);
+    if (e != -1)
+      RemoveLink(e);
   }
 }
 
 void AddNode(float x, float y)
 {
-  if (nodeCount >= MAX_NODES)
-    return;
+  if (nodeCount == nodeCapacity)
+    GrowNodeArrays(nodeCapacity ? nodeCapacity * 2 : 64);
   nodes[nodeCount].id = nodeCount;
   nodes[nodeCount].x = x;
   nodes[nodeCount].y = y;
-  nodes[nodeCount].connectionCount = 0;
+  InitNodeState(nodeCount);
   nodeCount++;
+  MarkTopologyChanged();
+  InvalidateRoutes();
 }
 
 void ConnectNodes(int a, int b)
 {
   if (a < 0 || b < 0 || a >= nodeCount || b >= nodeCount || a == b)
     return;
-  if (nodes[a].connectionCount >= MAX_CONNECTIONS || nodes[b].connectionCount >= MAX_CONNECTIONS)
-    return;
-  int exists = 0;
-  for (int i = 0; i < nodes[a].connectionCount; i++)
-    if (nodes[a].connections[i] == b)
-      exists = 1;
-  if (!exists)
-    nodes[a].connections[nodes[a].connectionCount++] = b;
-  exists = 0;
-  for (int i = 0; i < nodes[b].connectionCount; i++)
-    if (nodes[b].connections[i] == a)
-      exists = 1;
-  if (!exists)
-    nodes[b].connections[nodes[b].connectionCount++] = a;
-}
-
-// Usa a 'pathfindingNetwork' com a regra estrita da pista oposta.
-int BuildPath(int start, int goal, int *path, int maxLen)
+  if (FindEdge(a, b) == -1)
+  {
+    if (graph.edgeCount + 2 > graph.edgeCapacity)
+      GrowEdgeArrays(graph.edgeCapacity ? graph.edgeCapacity * 2 : 128);
+    // Índice com no máximo metade das posições ocupadas
+    if (2 * (graph.edgeCount + 2) > graph.edgeIndexCapacity)
+      GrowEdgeIndex(graph.edgeIndexCapacity ? graph.edgeIndexCapacity * 2 : 256);
+    AddEdge(a, b);
+    AddEdge(b, a);
+    MarkTopologyChanged();
+  }
+  InvalidateRoutes();
+}
+
+// Usa a ocupação das arestas com a regra estrita da pista oposta: a aresta
+// current->next só serve se a aresta next->current (e ^ 1) estiver vazia.
+static int SearchPath(int start, int goal, int *path)
 {
-  int visited[MAX_NODES] = {0};
-  int parent[MAX_NODES];
-  for (int i = 0; i < MAX_NODES; i++)
-    parent[i] = -1;
-  int queue[MAX_NODES], front = 0, rear = 0;
-  visited[start] = 1;
-  queue[rear++] = start;
+  EnsureAdjacency();
+  if (++searchStamp == 0)
+  {
+    for (int i = 0; i < nodeCapacity; i++)
+      searchVisited[i] = 0;
+    searchStamp = 1;
+  }
+  int front = 0, rear = 0;
+  searchVisited[start] = searchStamp;
+  searchParent[start] = -1;
+  searchQueue[rear++] = start;
   int found = 0;
   while (front < rear)
   {
-    int current = queue[front++];
+    int current = searchQueue[front++];
     if (current == goal)
     {
       found = 1;
       break;
     }
-    for (int i = 0; i < nodes[current].connectionCount; i++)
+    for (int k = graph.adjOffset[current]; k < graph.adjOffset[current + 1]; k++)
     {
-      int next = nodes[current].connections[i];
-      if (!visited[next] && pathfindingNetwork.graph[next][current] == 0)
+      int next = graph.adjTarget[k];
+      if (searchVisited[next] != searchStamp && edgeState[graph.adjEdge[k] ^ 1].load == 0)
       {
-        visited[next] = 1;
-        parent[next] = current;
-        queue[rear++] = next;
+        searchVisited[next] = searchStamp;
+        searchParent[next] = current;
+        searchQueue[rear++] = next;
       }
     }
   }
   if (!found)
     return -1;
-  int temp[MAX_NODES], len = 0;
-  int cur = goal;
-  while (cur != -1)
+  int len = 0;
+  for (int cur = goal; cur != -1; cur = searchParent[cur])
+    len++;
+  int i = len;
+  for (int cur = goal; cur != -1; cur = searchParent[cur])
+    path[--i] = cur;
+  return len;
+}
+
+//====================================================================================
+// TABELA DE ROTAS INTERNADAS
+//====================================================================================
+
+static unsigned int HashRoute(const int *hops, int length)
+{
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < length; i++)
+    hash = (hash ^ (unsigned int)hops[i]) * 16777619u;
+  return hash;
+}
+
+static void GrowRouteBuckets(RouteTable *t, int bucketCount)
+{
+  int *buckets = malloc(bucketCount * sizeof(int));
+  if (buckets == NULL)
   {
-    temp[len++] = cur;
-    cur = parent[cur];
+    fprintf(stderr, "Sem memoria para a tabela de rotas\n");
+    exit(1);
   }
-  for (int i = 0; i < len; i++)
+  for (int i = 0; i < bucketCount; i++)
+    buckets[i] = -1;
+  // Reencadeia as rotas vivas nos novos baldes
+  for (int r = 0; r < t->used; r++)
   {
-    path[i] = temp[len - i - 1];
+    if (t->routes[r].refCount == 0)
+      continue;
+    int b = t->routes[r].hash & (bucketCount - 1);
+    t->routes[r].next = buckets[b];
+    buckets[b] = r;
   }
-  return len;
+  free(t->buckets);
+  t->buckets = buckets;
+  t->bucketCount = bucketCount;
 }
 
-void CreateDefaultNetwork()
+// Descarta todas as rotas; só é seguro quando nenhuma mensagem as referencia.
+void ResetRouteTable(void)
 {
-  nodeCount = 0;
-  messageCount = 0;
-  actionTop = -1;
-  memset(&pathfindingNetwork, 0, sizeof(Network));
-  memset(&capacityNetwork, 0, sizeof(Network));
-  total_latency_ticks = 0;
-  completed_messages_count = 0;
-  total_retransmissions = 0;
+  RouteTable *t = &routeTable;
+  for (int r = 0; r < t->used; r++)
+    free(t->routes[r].hops);
+  t->used = 0;
+  t->count = 0;
+  t->freeHead = -1;
+  if (t->buckets == NULL)
+    GrowRouteBuckets(t, ROUTE_TABLE_BUCKETS);
+  for (int i = 0; i < t->bucketCount; i++)
+    t->buckets[i] = -1;
+  for (int i = 0; i < ROUTE_CACHE_SIZE; i++)
+  {
+    routeCache[i].epoch = 0;
+    routeCache[i].route = -1;
+  }
+}
 
-  AddNode(450, 360);
-  AddNode(300, 200);
-  AddNode(300, 520);
-  AddNode(600, 200);
-  AddNode(600, 520);
-  AddNode(120, 120);
-  AddNode(120, 360);
-  AddNode(120, 600);
-  AddNode(780, 120);
-  AddNode(780, 360);
+// Retorna o id da rota com esses nós, criando-a se ainda não existe.
+// O chamador recebe uma referência e deve devolvê-la com ReleaseRoute.
+int InternRoute(const int *hops, int length)
+{
+  RouteTable *t = &routeTable;
+  unsigned int hash = HashRoute(hops, length);
+  for (int r = t->buckets[hash & (t->bucketCount - 1)]; r != -1; r = t->routes[r].next)
+  {
+    Route *route = &t->routes[r];
+    if (route->hash == hash && route->length == length && memcmp(route->hops, hops, length * sizeof(int)) == 0)
+    {
+      route->refCount++;
+      return r;
+    }
+  }
+
+  // Cresce antes de ocupar o slot: GrowRouteBuckets reencadeia toda rota com
+  // refCount > 0, e a nova seria encadeada duas vezes
+  if (t->count + 1 > t->bucketCount)
+    GrowRouteBuckets(t, t->bucketCount * 2);
+  int r;
+  if (t->freeHead != -1)
+  {
+    r = t->freeHead;
+    t->freeHead = t->routes[r].next;
+  }
+  else
+  {
+    if (t->used == t->capacity)
+    {
+      int newCapacity = t->capacity ? t->capacity * 2 : 256;
+      Route *grown = realloc(t->routes, newCapacity * sizeof(Route));
+      if (grown == NULL)
+      {
+        fprintf(stderr, "Sem memoria para a tabela de rotas\n");
+        exit(1);
+      }
+      t->routes = grown;
+      t->capacity = newCapacity;
+    }
+    r = t->used++;
+  }
+  Route *route = &t->routes[r];
+  route->hops = malloc(length * sizeof(int));
+  if (route->hops == NULL)
+  {
+    fprintf(stderr, "Sem memoria para a tabela de rotas\n");
+    exit(1);
+  }
+  memcpy(route->hops, hops, length * sizeof(int));
+  route->length = length;
+  route->refCount = 1;
+  route->hash = hash;
+  t->count++;
+  int b = hash & (t->bucketCount - 1);
+  route->next = t->buckets[b];
+  t->buckets[b] = r;
+  return r;
+}
+
+void RetainRoute(int r)
+{
+  if (r != -1)
+    routeTable.routes[r].refCount++;
+}
+
+// Devolve uma referência; a rota é liberada quando ninguém mais a usa.
+void ReleaseRoute(int r)
+{
+  if (r == -1)
+    return;
+  RouteTable *t = &routeTable;
+  Route *route = &t->routes[r];
+  if (--route->refCount > 0)
+    return;
+  int *link = &t->buckets[route->hash & (t->bucketCount - 1)];
+  while (*link != r)
+    link = &t->routes[*link].next;
+  *link = route->next;
+  free(route->hops);
+  route->hops = NULL;
+  route->next = t->freeHead;
+  t->freeHead = r;
+  t->count--;
+}
+
+// Troca a rota guardada em *slot, ajustando as referências.
+void SetRoute(int *slot, int r)
+{
+  ReleaseRoute(*slot);
+  *slot = r;
+}
+
+int RouteLength(int r)
+{
+  return r == -1 ? 0 : routeTable.routes[r].length;
+}
+
+int RouteHop(int r, int index)
+{
+  return routeTable.routes[r].hops[index];
+}
+
+// Uma rota continua utilizável enquanto a pista oposta de cada salto está vazia.
+static bool RouteLanesIdle(int r)
+{
+  const Route *route = &routeTable.routes[r];
+  for (int i = 0; i + 1 < route->length; i++)
+  {
+    int e = FindEdge(route->hops[i], route->hops[i + 1]);
+    if (e == -1 || edgeState[e ^ 1].load != 0)
+      return false;
+  }
+  return true;
+}
+
+// Rota memoizada por (início, destino), a devolver com ReleaseRoute (-1 sem
+// caminho). Vale só dentro do routeEpoch em que foi calculada: uma aresta que
+// esvazia pode abrir um caminho mais curto. Dentro do mesmo routeEpoch as
+// arestas só são ocupadas, o que não encurta caminho nenhum, então a rota
+// guardada continua a mais curta enquanto suas pistas opostas seguem vazias.
+int AcquireRoute(int start, int goal)
+{
+  unsigned int hash = ((unsigned int)start * 2654435761u) ^ ((unsigned int)goal * 40503u);
+  RouteCacheEntry *e = &routeCache[hash & (ROUTE_CACHE_SIZE - 1)];
+  bool hit = e->start == start && e->goal == goal &&
+             e->epoch == routeEpoch && (e->route == -1 || RouteLanesIdle(e->route));
+  if (!hit)
+  {
+    route_cache_misses++;
+    int length = SearchPath(start, goal, searchPath);
+    // Caminhos iguais entre épocas diferentes voltam para a mesma rota
+    int r = length > 0 ? InternRoute(searchPath, length) : -1;
+    ReleaseRoute(e->route);
+    e->start = start;
+    e->goal = goal;
+    e->epoch = routeEpoch;
+    e->route = r;
+  }
+  else
+    route_cache_hits++;
+  RetainRoute(e->route);
+  return e->route;
+}
+
+// Copia a rota para 'path'. Retorna o tamanho, ou -1 sem caminho.
+int BuildPath(int start, int goal, int *path, int maxLen)
+{
+  int r = AcquireRoute(start, goal);
+  int length = r == -1 ? -1 : RouteLength(r);
+  if (length > maxLen)
+    length = -1;
+  if (length > 0)
+    memcpy(path, routeTable.routes[r].hops, length * sizeof(int));
+  ReleaseRoute(r);
+  return length;
+}
+
+void ResetLatencyHistograms(void);
+// Apaga a topologia, o histórico de desfazer, as estatísticas e o motor.
+void ResetNetwork(void)
+{
+  ClearGraph();
+  actionTop = -1;
+  total_latency_seconds = 0.0;
+  rttSmoothed = -1.0;
+  rttVariance = 0.0;
+  ResetLatencyHistograms();
+  engine_wall_seconds = 0.0;
+  engine_events_processed = 0;
+  completed_messages_count = 0;
+  total_retransmissions = 0;
+  ResetScheduler();
+}
+
+// Grade cols x rows com ligações entre vizinhos horizontais e verticais;
+// o nó (c, r) tem id r * cols + c.
+void CreateGridNetwork(int cols, int rows)
+{
+  ResetNetwork();
+  for (int r = 0; r < rows; r++)
+    for (int c = 0; c < cols; c++)
+      AddNode(60 + 80 * c, 60 + 80 * r);
+  for (int r = 0; r < rows; r++)
+    for (int c = 0; c < cols; c++)
+    {
+      if (c + 1 < cols)
+        ConnectNodes(r * cols + c, r * cols + c + 1);
+      if (r + 1 < rows)
+        ConnectNodes(r * cols + c, (r + 1) * cols + c);
+    }
+}
+
+void CreateDefaultNetwork()
+{
+  ResetNetwork();
+
+  AddNode(450, 360);
+  AddNode(300, 200);
+  AddNode(300, 520);
+  AddNode(600, 200);
+  AddNode(600, 520);
+  AddNode(120, 120);
+  AddNode(120, 360);
+  AddNode(120, 600);
+  AddNode(780, 120);
+  AddNode(780, 360);
   AddNode(780, 600);
   AddNode(450, 50);
   AddNode(450, 670);
@@ -264,560 +1311,4067 @@ void CreateDefaultNetwork()
 }
 
 //====================================================================================
-// LÓGICA PRINCIPAL DAS MENSAGENS
+// GERADORES DE TOPOLOGIA
 //====================================================================================
+// Redes sintéticas com 'n' nós, grau médio aproximado 'degree' e coordenadas
+// calculadas pelo próprio gerador. Os sorteios usam um splitmix64 próprio, então
+// a mesma semente dá a mesma rede sem consumir a sequência de rand() da carga.
+
+static uint64_t topologyRng;
 
-void AddAsyncMessage(int from, int to)
+static uint64_t TopologyRandom(void)
 {
-  if (messageCount >= MAX_MESSAGES)
-    return;
-  AsyncMessage *m = &messages[messageCount];
-  *m = (AsyncMessage){.from = from, .to = to, .retransmission_count = 0, .creation_time = clock()};
+  uint64_t z = (topologyRng += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// Uniforme em [0, 1)
+static double TopologyUniform(void)
+{
+  return (TopologyRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Aloca de uma vez as colunas para 'nodeTotal' nós e 'linkTotal' ligações; sem
+// isso AddNode e ConnectNodes dobram e copiam os vetores várias vezes.
+static void ReserveNetwork(int nodeTotal, long long linkTotal)
+{
+  if (nodeCapacity < nodeTotal)
+    GrowNodeArrays(nodeTotal);
+  if (graph.edgeCapacity < 2 * linkTotal)
+    GrowEdgeArrays((int)(2 * linkTotal));
+  // ConnectNodes mantém o índice no máximo meio cheio
+  int indexCapacity = 256;
+  while (indexCapacity < 4 * linkTotal)
+    indexCapacity *= 2;
+  if (graph.edgeIndexCapacity < indexCapacity)
+    GrowEdgeIndex(indexCapacity);
+}
+
+// Posição do nó 'i' numa espiral de Vogel (ângulo áureo) com 'n' nós: densidade
+// uniforme de um nó por TOPOLOGY_SPACING² num disco, com os primeiros ids no centro.
+static Vector2 SpiralPosition(int i, int n)
+{
+  double center = 60 + TOPOLOGY_SPACING * sqrt(n / PI);
+  double radius = TOPOLOGY_SPACING * sqrt((i + 0.5) / PI);
+  double angle = fmod(i * 2.399963229728653, 2 * PI);
+  return (Vector2){(float)(center + radius * cos(angle)), (float)(center + radius * sin(angle))};
+}
+
+// Grade com ceil(sqrt(n)) colunas, preenchida por linhas; a última pode ficar
+// incompleta. No toro, cada linha e cada coluna se fecham num anel.
+static void GenerateGrid(int n, bool torus)
+{
+  int cols = (int)ceil(sqrt((double)n));
+  ReserveNetwork(n, 2LL * n);
+  for (int i = 0; i < n; i++)
+    AddNode(60 + TOPOLOGY_SPACING * (i % cols), 60 + TOPOLOGY_SPACING * (i / cols));
+  for (int i = 0; i < n; i++)
+  {
+    int r = i / cols, c = i % cols;
+    if (c + 1 < cols && i + 1 < n)
+      ConnectNodes(i, i + 1);
+    else if (torus)
+      ConnectNodes(i, r * cols);
+    if (i + cols < n)
+      ConnectNodes(i, i + cols);
+    else if (torus)
+      ConnectNodes(i, c);
+  }
+}
+
+static void GenerateGridTopology(int n, int degree)
+{
+  (void)degree;
+  GenerateGrid(n, false);
+}
+
+static void GenerateTorusTopology(int n, int degree)
+{
+  (void)degree;
+  GenerateGrid(n, true);
+}
+
+// Grafo geométrico aleatório: nós uniformes num quadrado com um nó por
+// TOPOLOGY_SPACING², ligados quando estão a menos de um raio calculado para o
+// grau médio. Os pontos são ordenados por células do tamanho do raio antes de
+// virar nós, então os ids de cada célula são contíguos e os candidatos de um
+// nó estão nas 9 células vizinhas: custo O(n * degree) e não O(n²).
+static void GenerateGeometric(int n, int degree)
+{
+  double side = sqrt((double)n) * TOPOLOGY_SPACING;
+  float radius = TOPOLOGY_SPACING * sqrtf(degree / PI);
+  int cellsPerSide = (int)(side / radius);
+  if (cellsPerSide < 1)
+    cellsPerSide = 1;
+  double cellSize = side / cellsPerSide;
+  int cellTotal = cellsPerSide * cellsPerSide;
+  Vector2 *points = GrowColumn(NULL, sizeof(Vector2), n);
+  int *pointCell = GrowColumn(NULL, sizeof(int), n);
+  int *order = GrowColumn(NULL, sizeof(int), n);
+  int *cellOffset = GrowColumn(NULL, sizeof(int), cellTotal + 1);
+
+  for (int c = 0; c <= cellTotal; c++)
+    cellOffset[c] = 0;
+  for (int i = 0; i < n; i++)
+  {
+    double x = TopologyUniform() * side, y = TopologyUniform() * side;
+    int cx = (int)(x / cellSize), cy = (int)(y / cellSize);
+    if (cx >= cellsPerSide)
+      cx = cellsPerSide - 1;
+    if (cy >= cellsPerSide)
+      cy = cellsPerSide - 1;
+    points[i] = (Vector2){60 + (float)x, 60 + (float)y};
+    pointCell[i] = cy * cellsPerSide + cx;
+    cellOffset[pointCell[i] + 1]++;
+  }
+  for (int c = 0; c < cellTotal; c++)
+    cellOffset[c + 1] += cellOffset[c];
+  for (int i = 0; i < n; i++)
+    order[cellOffset[pointCell[i]]++] = i;
+  // Como em RebuildAdjacency, o laço acima avançou cada início até o da célula seguinte
+  for (int c = cellTotal; c > 0; c--)
+    cellOffset[c] = cellOffset[c - 1];
+  cellOffset[0] = 0;
+
+  ReserveNetwork(n, (long long)n * degree / 2 + n / 16 + 16);
+  for (int k = 0; k < n; k++)
+    AddNode(points[order[k]].x, points[order[k]].y);
+  float radiusSq = radius * radius;
+  for (int cy = 0; cy < cellsPerSide; cy++)
+    for (int cx = 0; cx < cellsPerSide; cx++)
+      for (int i = cellOffset[cy * cellsPerSide + cx]; i < cellOffset[cy * cellsPerSide + cx + 1]; i++)
+        for (int y = cy - 1; y <= cy + 1; y++)
+          for (int x = cx - 1; x <= cx + 1; x++)
+          {
+            if (x < 0 || y < 0 || x >= cellsPerSide || y >= cellsPerSide)
+              continue;
+            int c = y * cellsPerSide + x;
+            for (int j = cellOffset[c] > i + 1 ? cellOffset[c] : i + 1; j < cellOffset[c + 1]; j++)
+            {
+              float dx = nodes[j].x - nodes[i].x, dy = nodes[j].y - nodes[i].y;
+              if (dx * dx + dy * dy <= radiusSq)
+                ConnectNodes(i, j);
+            }
+          }
+  free(points);
+  free(pointCell);
+  free(order);
+  free(cellOffset);
+}
+
+// G(n, p) de Erdős–Rényi com p = degree / (n - 1). Em vez de sortear cada um
+// dos n²/2 pares, pula direto para o próximo par ligado: o salto tem
+// distribuição geométrica (Batagelj e Brandes, 2005), então o custo é O(n + ligações).
+static void GenerateErdosRenyi(int n, int degree)
+{
+  double p = (double)degree / (n - 1);
+  if (p > 1.0)
+    p = 1.0;
+  ReserveNetwork(n, (long long)(p * n * (n - 1) / 2 * 1.05) + 16);
+  for (int i = 0; i < n; i++)
+  {
+    Vector2 pos = SpiralPosition(i, n);
+    AddNode(pos.x, pos.y);
+  }
+  double logSkip = log(1.0 - p);
+  long long v = 1, w = -1;
+  while (v < n)
+  {
+    w += 1 + (long long)floor(log(1.0 - TopologyUniform()) / logSkip);
+    while (w >= v && v < n)
+    {
+      w -= v;
+      v++;
+    }
+    if (v < n)
+      ConnectNodes((int)v, (int)w);
+  }
+}
+
+// Barabási–Albert: cada nó novo se liga a m = degree / 2 nós existentes (pelo
+// menos 1), com probabilidade proporcional ao grau. Sortear uma ponta qualquer
+// das ligações já criadas faz essa escolha em O(1). Os primeiros m + 1 nós
+// formam uma clique inicial e, na espiral, os hubs antigos ficam no centro.
+static void GenerateBarabasiAlbert(int n, int degree)
+{
+  int m = degree / 2 < 1 ? 1 : degree / 2;
+  if (m > n - 1)
+    m = n - 1;
+  long long linkTotal = (long long)m * (m + 1) / 2 + (long long)(n - m - 1) * m;
+  ReserveNetwork(n, linkTotal);
+  int *ends = GrowColumn(NULL, sizeof(int), (int)(2 * linkTotal));
+  int *targets = GrowColumn(NULL, sizeof(int), m);
+  long long endCount = 0;
+  for (int i = 0; i < n; i++)
+  {
+    Vector2 pos = SpiralPosition(i, n);
+    AddNode(pos.x, pos.y);
+  }
+  for (int a = 0; a <= m; a++)
+    for (int b = a + 1; b <= m; b++)
+    {
+      ConnectNodes(a, b);
+      ends[endCount++] = a;
+      ends[endCount++] = b;
+    }
+  for (int v = m + 1; v < n; v++)
+  {
+    for (int k = 0; k < m; k++)
+    {
+      bool repeated;
+      do
+      {
+        targets[k] = ends[TopologyRandom() % endCount];
+        repeated = false;
+        for (int j = 0; j < k; j++)
+          repeated |= targets[j] == targets[k];
+      } while (repeated);
+    }
+    for (int k = 0; k < m; k++)
+    {
+      ConnectNodes(v, targets[k]);
+      ends[endCount++] = v;
+      ends[endCount++] = targets[k];
+    }
+  }
+  free(ends);
+  free(targets);
+}
+
+// Fat-tree k-ária (Al-Fares et al., 2008): (k/2)² switches de núcleo e k pods,
+// cada um com k/2 switches de agregação, k/2 de borda e (k/2)² hosts. k é o
+// menor par cujo total de 5k²/4 + k³/4 nós alcança n, então a rede pode ter
+// mais nós que o pedido. Os pods ficam numa grade abaixo do bloco de núcleo, com
+// os hosts de cada switch de borda empilhados embaixo dele.
+static void GenerateFatTree(int n, int degree)
+{
+  (void)degree;
+  int k = 2;
+  while (5LL * k * k / 4 + (long long)k * k * k / 4 < n)
+    k += 2;
+  int half = k / 2;
+  int coreCount = half * half;
+  int podSize = 2 * half + half * half;
+  int podCols = (int)ceil(sqrt((double)k));
+  float podWidth = (half + 1) * TOPOLOGY_SPACING, podHeight = (half + 3) * TOPOLOGY_SPACING;
+  float coreLeft = 60 + (podCols * podWidth - half * TOPOLOGY_SPACING) / 2;
+  float podsTop = 60 + (half + 1) * TOPOLOGY_SPACING;
+  ReserveNetwork(coreCount + k * podSize, 3LL * k * half * half);
+
+  for (int c = 0; c < coreCount; c++)
+    AddNode(coreLeft + TOPOLOGY_SPACING * (c % half), 60 + TOPOLOGY_SPACING * (c / half));
+  for (int p = 0; p < k; p++)
+  {
+    float left = 60 + podWidth * (p % podCols), top = podsTop + podHeight * (p / podCols);
+    for (int a = 0; a < half; a++)
+      AddNode(left + TOPOLOGY_SPACING * a, top);
+    for (int e = 0; e < half; e++)
+      AddNode(left + TOPOLOGY_SPACING * e, top + TOPOLOGY_SPACING);
+    for (int e = 0; e < half; e++)
+      for (int h = 0; h < half; h++)
+        AddNode(left + TOPOLOGY_SPACING * e, top + TOPOLOGY_SPACING * (2 + h));
+  }
+  for (int p = 0; p < k; p++)
+  {
+    int agg = coreCount + p * podSize, edge = agg + half, host = edge + half;
+    // O núcleo c liga na agregação c / (k/2) de cada pod
+    for (int c = 0; c < coreCount; c++)
+      ConnectNodes(c, agg + c / half);
+    for (int a = 0; a < half; a++)
+      for (int e = 0; e < half; e++)
+        ConnectNodes(agg + a, edge + e);
+    for (int e = 0; e < half; e++)
+      for (int h = 0; h < half; h++)
+        ConnectNodes(edge + e, host + e * half + h);
+  }
+}
+
+// Cliques de degree + 1 nós (pelo menos 3) ligadas em anel por uma ligação entre
+// cliques vizinhas; a última pode ficar menor. As cliques seguem uma serpentina
+// numa grade quase quadrada, então só a ligação que fecha o anel é longa.
+static void GenerateRingOfCliques(int n, int degree)
+{
+  int size = degree + 1 < 3 ? 3 : degree + 1;
+  if (size > n)
+    size = n;
+  int cliqueCount = (n + size - 1) / size;
+  int cols = (int)ceil(sqrt((double)cliqueCount));
+  // Membros num círculo com TOPOLOGY_SPACING entre vizinhos
+  float ring = size * TOPOLOGY_SPACING / (2 * PI);
+  float cell = 2 * ring + TOPOLOGY_SPACING;
+  ReserveNetwork(n, (long long)n * (size - 1) / 2 + cliqueCount);
+
+  for (int q = 0; q < cliqueCount; q++)
+  {
+    int row = q / cols, col = q % cols;
+    if (row % 2 == 1)
+      col = cols - 1 - col;
+    float cx = 60 + ring + cell * col, cy = 60 + ring + cell * row;
+    int first = q * size, members = (q == cliqueCount - 1) ? n - first : size;
+    for (int j = 0; j < members; j++)
+    {
+      float angle = 2 * PI * j / members;
+      AddNode(cx + ring * cosf(angle), cy + ring * sinf(angle));
+    }
+    for (int a = 0; a < members; a++)
+      for (int b = a + 1; b < members; b++)
+        ConnectNodes(first + a, first + b);
+    if (q > 0)
+      ConnectNodes(first - 1, first);
+  }
+  if (cliqueCount > 2)
+    ConnectNodes(n - 1, 0);
+}
+
+typedef struct TopologyGenerator
+{
+  const char *name;
+  void (*generate)(int n, int degree);
+} TopologyGenerator;
+
+TopologyGenerator topologyGenerators[] = {
+    {"grid", GenerateGridTopology},
+    {"torus", GenerateTorusTopology},
+    {"geometric", GenerateGeometric},
+    {"erdos-renyi", GenerateErdosRenyi},
+    {"barabasi-albert", GenerateBarabasiAlbert},
+    {"fat-tree", GenerateFatTree},
+    {"ring-of-cliques", GenerateRingOfCliques},
+};
+
+// Substitui a rede pela topologia 'name' ("default" é a rede fixa de
+// CreateDefaultNetwork e ignora os outros parâmetros). Retorna false, sem
+// mexer na rede, se o nome não existe.
+bool CreateTopology(const char *name, int n, int degree, unsigned int seed)
+{
+  if (strcmp(name, "default") == 0)
+  {
+    CreateDefaultNetwork();
+    return true;
+  }
+  for (size_t i = 0; i < sizeof(topologyGenerators) / sizeof(topologyGenerators[0]); i++)
+    if (strcmp(name, topologyGenerators[i].name) == 0)
+    {
+      ResetNetwork();
+      topologyRng = seed;
+      topologyGenerators[i].generate(n, degree);
+      return true;
+    }
+  return false;
+}
+
+//====================================================================================
+// ARQUIVOS DE TOPOLOGIA
+//====================================================================================
+// Dois formatos, reconhecidos pelo início do arquivo:
+// - texto: uma ligação "a b [capacidade]" por linha, linhas "node id x y"
+//   opcionais e comentários com '#'. Nós sem linha "node" vão para a espiral.
+// - binário: um cabeçalho e as colunas do grafo como o motor as guarda (CSR,
+//   pares de arestas e índice de arestas), na ordem de bytes da máquina.
+//   Carregar é mapear o arquivo e copiar blocos, sem interpretar texto nem
+//   calcular hashes.
+// Capacidade 0 numa aresta significa a padrão do momento (linkCapacity, --capacity).
+
+typedef struct TopologyFileHeader
+{
+  char magic[8];          // TOPOLOGY_FILE_MAGIC
+  uint32_t version;       // TOPOLOGY_FILE_VERSION
+  uint32_t nodeCount;
+  uint32_t edgeCount;     // Arestas dirigidas, duas por ligação
+  uint32_t indexCapacity; // Posições do índice de arestas (potência de 2)
+} TopologyFileHeader;
+// Depois do cabeçalho, todas com 4 bytes por elemento: float x, y por nó,
+// adjOffset[nodeCount + 1], adjEdge, adjTarget, edgeFrom, edgeTo e capacity
+// [edgeCount], e edgeIndex[indexCapacity].
+
+// Conteúdo do arquivo inteiro, só para leitura, ou NULL. Em POSIX é um mmap e
+// as páginas só são lidas quando tocadas; no Windows, fread num bloco alocado.
+static const unsigned char *MapTopologyFile(const char *path, size_t *size)
+{
+#ifndef _WIN32
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    return NULL;
+  }
+  void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+  *size = (size_t)st.st_size;
+  return data;
+#else
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  long length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  unsigned char *data = length > 0 ? malloc((size_t)length) : NULL;
+  if (data != NULL && fread(data, 1, (size_t)length, f) != (size_t)length)
+  {
+    free(data);
+    data = NULL;
+  }
+  fclose(f);
+  *size = (size_t)length;
+  return data;
+#endif
+}
+
+static void UnmapTopologyFile(const unsigned char *data, size_t size)
+{
+#ifndef _WIN32
+  munmap((void *)data, size);
+#else
+  (void)size;
+  free((void *)data);
+#endif
+}
+
+static bool LoadTopologyBinary(const char *path, const unsigned char *data, size_t size)
+{
+  TopologyFileHeader h;
+  if (size < sizeof(h))
+  {
+    fprintf(stderr, "%s: arquivo truncado\n", path);
+    return false;
+  }
+  memcpy(&h, data, sizeof(h));
+  if (h.version != TOPOLOGY_FILE_VERSION)
+  {
+    fprintf(stderr, "%s: versao %u do formato nao suportada (esperada %d)\n", path, h.version, TOPOLOGY_FILE_VERSION);
+    return false;
+  }
+  size_t n = h.nodeCount, edges = h.edgeCount, indexCapacity = h.indexCapacity;
+  if (n > TOPOLOGY_MAX_NODES || edges % 2 != 0 || edges > INT32_MAX / 2 || indexCapacity < 2 * edges ||
+      indexCapacity > INT32_MAX || (indexCapacity & (indexCapacity - 1)) != 0 ||
+      size != sizeof(h) + 4 * (2 * n + n + 1 + 5 * edges + indexCapacity))
+  {
+    fprintf(stderr, "%s: cabecalho invalido\n", path);
+    return false;
+  }
+  const float *xy = (const float *)(data + sizeof(h));
+  const int *adjOffset = (const int *)(xy + 2 * n);
+  const int *adjEdge = adjOffset + n + 1;
+  const int *adjTarget = adjEdge + edges;
+  const int *edgeFrom = adjTarget + edges;
+  const int *edgeTo = edgeFrom + edges;
+  const int *capacity = edgeTo + edges;
+  const int *edgeIndex = capacity + edges;
+
+  // O CSR e o índice são usados como vieram, sem reconstrução: primeiro os
+  // limites, para que ids fora do lugar não corrompam a memória
+  bool valid = adjOffset[0] == 0 && adjOffset[n] == (int)edges;
+  for (size_t i = 0; i < n && valid; i++)
+    valid = adjOffset[i] <= adjOffset[i + 1];
+  for (size_t e = 0; e < edges && valid; e++)
+    valid = (unsigned)edgeFrom[e] < n && (unsigned)edgeTo[e] < n && (unsigned)adjEdge[e] < edges &&
+            (unsigned)adjTarget[e] < n && capacity[e] >= 0;
+  size_t emptySlots = 0;
+  for (size_t i = 0; i < indexCapacity && valid; i++)
+  {
+    valid = edgeIndex[i] >= -1 && edgeIndex[i] < (int)edges;
+    emptySlots += edgeIndex[i] == -1;
+  }
+  // FindEdge para na primeira posição vazia
+  valid = valid && emptySlots > 0;
+
+  // Depois a coerência entre as colunas, em O(E): a aresta e ^ 1 é a volta de e
+  for (size_t e = 0; e < edges && valid; e += 2)
+    valid = edgeFrom[e] != edgeTo[e] && edgeFrom[e] == edgeTo[e + 1] && edgeTo[e] == edgeFrom[e + 1];
+  // O trecho do CSR de cada nó lista suas arestas de saída, cada aresta uma vez
+  unsigned char *seen = calloc(edges > 0 ? edges : 1, 1); // Bit 1: no CSR; bit 2: no índice
+  if (seen == NULL)
+  {
+    fprintf(stderr, "Sem memoria\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < n && valid; i++)
+    for (int k = adjOffset[i]; k < adjOffset[i + 1] && valid; k++)
+    {
+      int e = adjEdge[k];
+      valid = edgeFrom[e] == (int)i && adjTarget[k] == edgeTo[e] && !(seen[e] & 1);
+      seen[e] |= 1;
+    }
+  // Cada posição ocupada do índice precisa ser alcançável pela sondagem linear
+  // de FindEdge: a posição inicial do hash do seu par fica no mesmo trecho sem
+  // vagas, antes dela. Percorre o anel a partir de uma vaga, lembrando onde o
+  // trecho atual começou.
+  if (valid)
+  {
+    size_t mask = indexCapacity - 1, firstEmpty = 0;
+    while (edgeIndex[firstEmpty] != -1)
+      firstEmpty++;
+    size_t runStart = (firstEmpty + 1) & mask;
+    for (size_t step = 1; step <= indexCapacity && valid; step++)
+    {
+      size_t slot = (firstEmpty + step) & mask;
+      int e = edgeIndex[slot];
+      if (e == -1)
+      {
+        runStart = (slot + 1) & mask;
+        continue;
+      }
+      size_t home = HashEdge(edgeFrom[e], edgeTo[e]) & mask;
+      valid = ((slot - home) & mask) <= ((slot - runStart) & mask) && !(seen[e] & 2);
+      seen[e] |= 2;
+    }
+  }
+  for (size_t e = 0; e < edges && valid; e++)
+    valid = seen[e] == 3;
+  free(seen);
+  if (!valid)
+  {
+    fprintf(stderr, "%s: grafo invalido\n", path);
+    return false;
+  }
+
+  ResetNetwork();
+  if ((size_t)nodeCapacity < n || nodeCapacity == 0)
+    GrowNodeArrays(n > 0 ? (int)n : 64);
+  if ((size_t)graph.edgeCapacity < edges)
+    GrowEdgeArrays((int)edges);
+  free(graph.edgeIndex);
+  graph.edgeIndex = GrowColumn(NULL, sizeof(int), (int)indexCapacity);
+  graph.edgeIndexCapacity = (int)indexCapacity;
+  memcpy(graph.edgeIndex, edgeIndex, indexCapacity * sizeof(int));
+
+  for (size_t i = 0; i < n; i++)
+  {
+    nodes[i] = (Node){xy[2 * i], xy[2 * i + 1], (int)i};
+    InitNodeState((int)i);
+  }
+  memcpy(graph.adjOffset, adjOffset, (n + 1) * sizeof(int));
+  memcpy(graph.adjEdge, adjEdge, edges * sizeof(int));
+  memcpy(graph.adjTarget, adjTarget, edges * sizeof(int));
+  memcpy(graph.edgeFrom, edgeFrom, edges * sizeof(int));
+  memcpy(graph.edgeTo, edgeTo, edges * sizeof(int));
+  for (size_t e = 0; e < edges; e++)
+  {
+    graph.edgeAlive[e] = true;
+    edgeState[e] = IdleEdgeState(capacity[e] > 0 ? capacity[e] : linkCapacity);
+    atomic_init(&edgeLoadDelta[e], 0);
+  }
+  // Anéis de amostras zerados sem escrever neles: o calloc de um bloco grande
+  // devolve páginas novas, que o sistema só preenche quando tocadas
+  free(linkSamples);
+  linkSamples = calloc((size_t)graph.edgeCapacity * LINK_SAMPLE_COUNT, sizeof(*linkSamples));
+  if (linkSamples == NULL && graph.edgeCapacity > 0)
+  {
+    fprintf(stderr, "Sem memoria\n");
+    exit(1);
+  }
+  nodeCount = (int)n;
+  graph.edgeCount = (int)edges;
+  // O CSR veio pronto do arquivo
+  graph.version++;
+  graph.dirty = false;
+  InvalidateRoutes();
+  return true;
+}
+
+typedef struct TextLink
+{
+  int a, b, capacity;
+} TextLink;
+
+// Lista de arestas em texto. Lê tudo antes de tocar na rede, então um erro de
+// sintaxe deixa a topologia atual intacta.
+static bool LoadTopologyText(const char *path, const unsigned char *data, size_t size)
+{
+  TextLink *links = NULL;
+  int linkCount = 0, linkSlots = 0;
+  int *placedNode = NULL;
+  Vector2 *placedPos = NULL;
+  int placedCount = 0, placedSlots = 0;
+  int n = 0;
+  int lineNumber = 0;
+  bool ok = true;
+  const char *cursor = (const char *)data, *end = (const char *)data + size;
+  while (cursor < end && ok)
+  {
+    const char *lineEnd = memchr(cursor, '\n', end - cursor);
+    if (lineEnd == NULL)
+      lineEnd = end;
+    char line[256];
+    size_t length = lineEnd - cursor;
+    lineNumber++;
+    if (length >= sizeof(line))
+    {
+      fprintf(stderr, "%s:%d: linha longa demais\n", path, lineNumber);
+      ok = false;
+      break;
+    }
+    memcpy(line, cursor, length);
+    line[length] = '\0';
+    cursor = lineEnd + 1;
+    char *comment = strchr(line, '#');
+    if (comment != NULL)
+      *comment = '\0';
+
+    char *p = line;
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+      p++;
+    if (*p == '\0')
+      continue;
+    char *next;
+    if (strncmp(p, "node", 4) == 0 && (p[4] == ' ' || p[4] == '\t'))
+    {
+      long id = strtol(p + 4, &next, 10);
+      float x = 0.0f, y = 0.0f;
+      bool parsed = next != p + 4;
+      if (parsed)
+      {
+        p = next;
+        x = strtof(p, &next);
+        parsed = next != p;
+        p = next;
+        y = strtof(p, &next);
+        parsed = parsed && next != p;
+      }
+      if (!parsed || id < 0 || id >= TOPOLOGY_MAX_NODES)
+      {
+        fprintf(stderr, "%s:%d: esperado \"node id x y\"\n", path, lineNumber);
+        ok = false;
+        break;
+      }
+      if (placedCount == placedSlots)
+      {
+        placedSlots = placedSlots ? placedSlots * 2 : 256;
+        placedNode = GrowColumn(placedNode, sizeof(*placedNode), placedSlots);
+        placedPos = GrowColumn(placedPos, sizeof(*placedPos), placedSlots);
+      }
+      placedNode[placedCount] = (int)id;
+      placedPos[placedCount++] = (Vector2){x, y};
+      if (id + 1 > n)
+        n = (int)id + 1;
+      continue;
+    }
+
+    long a = strtol(p, &next, 10);
+    bool parsed = next != p;
+    p = next;
+    long b = strtol(p, &next, 10);
+    parsed = parsed && next != p;
+    p = next;
+    long capacity = strtol(p, &next, 10);
+    if (next == p)
+      capacity = 0;
+    p = next;
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+      p++;
+    if (!parsed || *p != '\0' || a < 0 || b < 0 || a >= TOPOLOGY_MAX_NODES || b >= TOPOLOGY_MAX_NODES || capacity < 0)
+    {
+      fprintf(stderr, "%s:%d: esperado \"a b [capacidade]\"\n", path, lineNumber);
+      ok = false;
+      break;
+    }
+    if (linkCount == linkSlots)
+    {
+      linkSlots = linkSlots ? linkSlots * 2 : 256;
+      links = GrowColumn(links, sizeof(*links), linkSlots);
+    }
+    links[linkCount++] = (TextLink){(int)a, (int)b, (int)capacity};
+    if (a + 1 > n)
+      n = (int)a + 1;
+    if (b + 1 > n)
+      n = (int)b + 1;
+  }
+  if (ok && n == 0)
+  {
+    fprintf(stderr, "%s: nenhum no\n", path);
+    ok = false;
+  }
+
+  if (ok)
+  {
+    ResetNetwork();
+    ReserveNetwork(n, linkCount);
+    for (int i = 0; i < n; i++)
+    {
+      Vector2 pos = SpiralPosition(i, n);
+      AddNode(pos.x, pos.y);
+    }
+    for (int k = 0; k < placedCount; k++)
+    {
+      nodes[placedNode[k]].x = placedPos[k].x;
+      nodes[placedNode[k]].y = placedPos[k].y;
+    }
+    for (int k = 0; k < linkCount; k++)
+    {
+      ConnectNodes(links[k].a, links[k].b);
+      int e = FindEdge(links[k].a, links[k].b);
+      if (e != -1 && links[k].capacity > 0)
+        edgeState[e].capacity = edgeState[e ^ 1].capacity = links[k].capacity;
+    }
+  }
+  free(links);
+  free(placedNode);
+  free(placedPos);
+  return ok;
+}
+
+// Substitui a rede pela topologia do arquivo. Em caso de erro imprime o motivo
+// e retorna false; a rede só muda quando o arquivo inteiro é válido.
+bool LoadTopologyFile(const char *path)
+{
+  size_t size = 0;
+  const unsigned char *data = MapTopologyFile(path, &size);
+  if (data == NULL)
+  {
+    fprintf(stderr, "Nao foi possivel ler %s\n", path);
+    return false;
+  }
+  bool ok;
+  if (size >= sizeof(TopologyFileHeader) && memcmp(data, TOPOLOGY_FILE_MAGIC, sizeof(TOPOLOGY_FILE_MAGIC)) == 0)
+    ok = LoadTopologyBinary(path, data, size);
+  else
+    ok = LoadTopologyText(path, data, size);
+  UnmapTopologyFile(data, size);
+  return ok;
+}
+
+// Capacidade a gravar: 0 quando a aresta usa a padrão atual.
+static int SavedCapacity(int edge)
+{
+  return edgeState[edge].capacity == linkCapacity ? 0 : edgeState[edge].capacity;
+}
+
+static bool SaveTopologyText(FILE *f)
+{
+  fprintf(f, "# %d nos\n", nodeCount);
+  for (int i = 0; i < nodeCount; i++)
+    fprintf(f, "node %d %.9g %.9g\n", i, nodes[i].x, nodes[i].y);
+  for (int e = 0; e < graph.edgeCount; e += 2)
+  {
+    if (!graph.edgeAlive[e])
+      continue;
+    if (SavedCapacity(e) > 0)
+      fprintf(f, "%d %d %d\n", graph.edgeFrom[e], graph.edgeTo[e], SavedCapacity(e));
+    else
+      fprintf(f, "%d %d\n", graph.edgeFrom[e], graph.edgeTo[e]);
+  }
+  return !ferror(f);
+}
+
+// Grava só as ligações vivas, com ids renumerados na mesma ordem, e monta um
+// índice de arestas novo para elas.
+static bool SaveTopologyBinary(FILE *f)
+{
+  EnsureAdjacency();
+  int *newId = GrowColumn(NULL, sizeof(int), graph.edgeCount + 1);
+  int edges = 0;
+  for (int e = 0; e < graph.edgeCount; e++)
+    newId[e] = graph.edgeAlive[e] ? edges++ : -1;
+  TopologyFileHeader h = {.magic = TOPOLOGY_FILE_MAGIC, .version = TOPOLOGY_FILE_VERSION,
+                          .nodeCount = nodeCount, .edgeCount = edges, .indexCapacity = 256};
+  while (h.indexCapacity < 2 * (uint32_t)(edges + 2))
+    h.indexCapacity *= 2;
+
+  float *xy = GrowColumn(NULL, sizeof(float), 2 * nodeCount + 1);
+  int *columns = GrowColumn(NULL, sizeof(int), 5 * edges + 1);
+  int *adjEdge = columns, *edgeFrom = columns + edges, *edgeTo = columns + 2 * edges;
+  int *capacity = columns + 3 * edges, *adjTarget = columns + 4 * edges;
+  int *index = GrowColumn(NULL, sizeof(int), h.indexCapacity);
+  for (int i = 0; i < nodeCount; i++)
+  {
+    xy[2 * i] = nodes[i].x;
+    xy[2 * i + 1] = nodes[i].y;
+  }
+  for (int k = 0; k < edges; k++)
+  {
+    adjEdge[k] = newId[graph.adjEdge[k]];
+    adjTarget[k] = graph.adjTarget[k];
+  }
+  for (int e = 0; e < graph.edgeCount; e++)
+    if (newId[e] != -1)
+    {
+      edgeFrom[newId[e]] = graph.edgeFrom[e];
+      edgeTo[newId[e]] = graph.edgeTo[e];
+      capacity[newId[e]] = SavedCapacity(e);
+    }
+  for (uint32_t i = 0; i < h.indexCapacity; i++)
+    index[i] = -1;
+  for (int e = 0; e < edges; e++)
+    InsertEdgeIndex(index, h.indexCapacity, edgeFrom, edgeTo, e);
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(xy, sizeof(float), 2 * nodeCount, f) == (size_t)(2 * nodeCount) &&
+            fwrite(graph.adjOffset, sizeof(int), nodeCount + 1, f) == (size_t)(nodeCount + 1) &&
+            fwrite(adjEdge, sizeof(int), edges, f) == (size_t)edges &&
+            fwrite(adjTarget, sizeof(int), edges, f) == (size_t)edges &&
+            fwrite(edgeFrom, sizeof(int), edges, f) == (size_t)edges &&
+            fwrite(edgeTo, sizeof(int), edges, f) == (size_t)edges &&
+            fwrite(capacity, sizeof(int), edges, f) == (size_t)edges &&
+            fwrite(index, sizeof(int), h.indexCapacity, f) == h.indexCapacity;
+  free(newId);
+  free(xy);
+  free(columns);
+  free(index);
+  return ok;
+}
+
+// Grava a rede atual: lista de arestas em texto se 'path' termina em ".txt",
+// formato binário nos outros casos.
+bool SaveTopologyFile(const char *path)
+{
+  size_t length = strlen(path);
+  bool text = length >= 4 && strcmp(path + length - 4, ".txt") == 0;
+  FILE *f = fopen(path, text ? "w" : "wb");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Nao foi possivel criar %s\n", path);
+    return false;
+  }
+  bool ok = text ? SaveTopologyText(f) : SaveTopologyBinary(f);
+  if (fclose(f) != 0)
+    ok = false;
+  if (!ok)
+    fprintf(stderr, "Erro ao gravar %s\n", path);
+  return ok;
+}
+
+//====================================================================================
+// HISTOGRAMA DE LATÊNCIA
+//====================================================================================
+// Baldes log-lineares no estilo HDR: cada potência de 2 de microssegundos é
+// dividida em LATENCY_SUB_BUCKETS partes iguais, então registrar é O(1) e
+// qualquer percentil sai com erro relativo de no máximo 1/LATENCY_SUB_BUCKETS.
+
+static int LatencyBucket(unsigned long long micros)
+{
+  if (micros < LATENCY_SUB_BUCKETS)
+    return (int)micros;
+  int shift = 63 - __builtin_clzll(micros) - LATENCY_SUB_BITS;
+  return (shift + 1) * LATENCY_SUB_BUCKETS + (int)(micros >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+// Maior valor, em microssegundos, que cai no balde
+static unsigned long long LatencyBucketTop(int bucket)
+{
+  if (bucket < LATENCY_SUB_BUCKETS)
+    return (unsigned long long)bucket;
+  int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+  return ((unsigned long long)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << shift) + (1ULL << shift) - 1;
+}
+
+void RecordLatency(LatencyHistogram *h, double seconds)
+{
+  double micros = seconds * 1e6;
+  unsigned long long value = micros <= 0.0 ? 0 : micros >= LATENCY_MAX_MICROS ? LATENCY_MAX_MICROS : (unsigned long long)llround(micros);
+  h->counts[LatencyBucket(value)]++;
+  h->total++;
+  if (value > h->maxMicros)
+    h->maxMicros = value;
+}
+
+// Latência em segundos abaixo da qual ficam 'percent' % das amostras (0 se vazio).
+double LatencyPercentile(const LatencyHistogram *h, double percent)
+{
+  if (h->total == 0)
+    return 0.0;
+  long long rank = (long long)ceil(percent / 100.0 * h->total);
+  rank = rank < 1 ? 1 : rank;
+  long long seen = 0;
+  for (int b = 0; b < LATENCY_BUCKETS; b++)
+  {
+    seen += h->counts[b];
+    if (seen >= rank)
+    {
+      unsigned long long top = LatencyBucketTop(b);
+      return (top < h->maxMicros ? top : h->maxMicros) / 1e6;
+    }
+  }
+  return h->maxMicros / 1e6;
+}
+
+static LatencyHistogram *NewLatencyHistogram(void)
+{
+  LatencyHistogram *h = calloc(1, sizeof(*h));
+  if (h == NULL)
+  {
+    fprintf(stderr, "Sem memoria\n");
+    exit(1);
+  }
+  return h;
+}
+
+// Histograma do fluxo from->to, criado na primeira mensagem concluída dele.
+static LatencyHistogram *FlowHistogram(int from, int to)
+{
+  if (2 * (flowLatencyCount + 1) > flowLatencyCapacity)
+  {
+    int oldCapacity = flowLatencyCapacity;
+    FlowLatency *old = flowLatency;
+    flowLatencyCapacity = oldCapacity ? 2 * oldCapacity : 256;
+    flowLatency = GrowColumn(NULL, sizeof(*flowLatency), flowLatencyCapacity);
+    for (int i = 0; i < flowLatencyCapacity; i++)
+      flowLatency[i].hist = NULL;
+    for (int i = 0; i < oldCapacity; i++)
+      if (old[i].hist != NULL)
+      {
+        unsigned int slot = HashEdge(old[i].from, old[i].to) & (flowLatencyCapacity - 1);
+        while (flowLatency[slot].hist != NULL)
+          slot = (slot + 1) & (flowLatencyCapacity - 1);
+        flowLatency[slot] = old[i];
+      }
+    free(old);
+  }
+  unsigned int slot = HashEdge(from, to) & (flowLatencyCapacity - 1);
+  while (flowLatency[slot].hist != NULL)
+  {
+    if (flowLatency[slot].from == from && flowLatency[slot].to == to)
+      return flowLatency[slot].hist;
+    slot = (slot + 1) & (flowLatencyCapacity - 1);
+  }
+  flowLatency[slot] = (FlowLatency){from, to, NewLatencyHistogram()};
+  flowLatencyCount++;
+  return flowLatency[slot].hist;
+}
+
+// Registra a latência de uma mensagem cujo ACK acabou de voltar à origem e
+// alimenta a estimativa de RTT. Mensagens retransmitidas também contam (ao
+// contrário do algoritmo de Karn no TCP): o timeout descarta a tentativa
+// anterior, então o ACK é sempre do último envio.
+void RecordCompletion(int id)
+{
+  double rtt = simTime - msgs.sendTime[id];
+  if (rttSmoothed < 0.0)
+  {
+    rttSmoothed = rtt;
+    rttVariance = rtt / 2;
+  }
+  else
+  {
+    rttVariance += (fabs(rtt - rttSmoothed) - rttVariance) / 4;
+    rttSmoothed += (rtt - rttSmoothed) / 8;
+  }
+  double seconds = simTime - msgs.creation_time[id];
+  RecordLatency(&latencyHistogram, seconds);
+  if (!latencyBreakdown)
+    return;
+  int hops = RouteLength(msgs.route[id]) - 1;
+  hops = hops < 1 ? 1 : (hops > LATENCY_HOP_CLASSES ? LATENCY_HOP_CLASSES : hops);
+  if (latencyByHops[hops - 1] == NULL)
+    latencyByHops[hops - 1] = NewLatencyHistogram();
+  RecordLatency(latencyByHops[hops - 1], seconds);
+  RecordLatency(FlowHistogram(msgs.from[id], msgs.to[id]), seconds);
+}
+
+void ResetLatencyHistograms(void)
+{
+  memset(&latencyHistogram, 0, sizeof(latencyHistogram));
+  for (int i = 0; i < LATENCY_HOP_CLASSES; i++)
+  {
+    free(latencyByHops[i]);
+    latencyByHops[i] = NULL;
+  }
+  for (int i = 0; i < flowLatencyCapacity; i++)
+    free(flowLatency[i].hist);
+  free(flowLatency);
+  flowLatency = NULL;
+  flowLatencyCapacity = flowLatencyCount = 0;
+}
+
+//====================================================================================
+// RASTREAMENTO DE MENSAGENS (TRACE)
+//====================================================================================
+// Opcional: cada transição de uma mensagem vira um TraceRecord de tamanho fixo
+// num anel de potência de 2 que sobrescreve os mais antigos. Só a thread do
+// motor grava. ExportChromeTrace converte o anel em JSON do formato Trace
+// Event (chrome://tracing, Perfetto), com uma trilha por nó e uma por aresta.
+
+static void TraceEvent(TraceKind kind, int id, int where)
+{
+  if (traceRing == NULL)
+    return;
+  bool ack = msgs.ackRoute[id] != -1;
+  traceRing[traceWritten++ & (traceCapacity - 1)] = (TraceRecord){
+      .time = simTime,
+      .message = id,
+      .where = where,
+      .kind = (unsigned char)kind,
+      .ack = ack,
+      .hop = (unsigned short)(ack ? msgs.currentAckSegment[id] : msgs.currentSegment[id]),
+  };
+}
+
+// Liga o rastreamento com espaço para 'records' registros (arredondado para potência de 2).
+void StartTrace(int records)
+{
+  int capacity = 1;
+  while (capacity < records)
+    capacity *= 2;
+  traceRing = GrowColumn(traceRing, sizeof(*traceRing), capacity);
+  traceCapacity = capacity;
+  traceWritten = 0;
+}
+
+void StopTrace(void)
+{
+  free(traceRing);
+  traceRing = NULL;
+  traceCapacity = 0;
+  traceWritten = 0;
+}
+
+// Os eventos vêm depois dos metadados, então sempre começam com vírgula.
+static void WriteTraceSpan(FILE *f, int pid, int tid, const char *name, int id, int hop, double start, double end)
+{
+  fprintf(f, ",\n{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"name\":\"%s %d\",\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"msg\":%d,\"hop\":%d}}",
+          pid, tid, name, id, start * 1e6, (end - start) * 1e6, id, hop);
+}
+
+static void WriteTraceInstant(FILE *f, int node, const char *name, int id, double time)
+{
+  fprintf(f, ",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"name\":\"%s %d\",\"ts\":%.3f,\"args\":{\"msg\":%d}}",
+          TRACE_PID_NODES, node, name, id, time * 1e6, id);
+}
+
+// Grava o conteúdo do anel em 'path'. Segmentos e esperas em fila viram
+// intervalos nas trilhas da aresta e do nó; criação, timeout e conclusão viram
+// marcas instantâneas no nó de origem. Intervalos cujo início já foi
+// sobrescrito no anel são descartados. Retorna o número de registros lidos, ou
+// -1 se o arquivo não pôde ser aberto.
+long long ExportChromeTrace(const char *path)
+{
+  FILE *f = fopen(path, "w");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Nao foi possivel abrir %s\n", path);
+    return -1;
+  }
+  long long first = traceWritten > traceCapacity ? traceWritten - traceCapacity : 0;
+  int maxId = -1;
+  for (long long k = first; k < traceWritten; k++)
+    if (traceRing[k & (traceCapacity - 1)].message > maxId)
+      maxId = traceRing[k & (traceCapacity - 1)].message;
+  // Início do segmento e da espera em aberto de cada mensagem (-1 = nenhum)
+  double *segmentStart = GrowColumn(NULL, sizeof(*segmentStart), maxId + 1);
+  double *queueStart = GrowColumn(NULL, sizeof(*queueStart), maxId + 1);
+  for (int i = 0; i <= maxId; i++)
+    segmentStart[i] = queueStart[i] = -1.0;
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  fprintf(f, "\n{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":\"Nos\"}}", TRACE_PID_NODES);
+  fprintf(f, ",\n{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":\"Ligacoes\"}}", TRACE_PID_LINKS);
+  for (int i = 0; i < nodeCount; i++)
+    fprintf(f, ",\n{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"no %d\"}}", TRACE_PID_NODES, i, i);
+  for (int e = 0; e < graph.edgeCount; e++)
+    fprintf(f, ",\n{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%d->%d\"}}", TRACE_PID_LINKS, e,
+            graph.edgeFrom[e], graph.edgeTo[e]);
+
+  for (long long k = first; k < traceWritten; k++)
+  {
+    const TraceRecord *r = &traceRing[k & (traceCapacity - 1)];
+    int id = r->message;
+    const char *leg = r->ack ? "ack" : "msg";
+    switch ((TraceKind)r->kind)
+    {
+    case TRACE_CREATED:
+      WriteTraceInstant(f, r->where, "criada", id, r->time);
+      break;
+    case TRACE_SEGMENT_START:
+      segmentStart[id] = r->time;
+      break;
+    case TRACE_SEGMENT_END:
+      if (segmentStart[id] >= 0.0)
+        WriteTraceSpan(f, TRACE_PID_LINKS, r->where, leg, id, r->hop, segmentStart[id], r->time);
+      segmentStart[id] = -1.0;
+      break;
+    case TRACE_QUEUED:
+      queueStart[id] = r->time;
+      break;
+    case TRACE_DEQUEUED:
+      if (queueStart[id] >= 0.0)
+        WriteTraceSpan(f, TRACE_PID_NODES, r->where, r->ack ? "fila ack" : "fila msg", id, r->hop, queueStart[id], r->time);
+      queueStart[id] = -1.0;
+      break;
+    case TRACE_TIMEOUT:
+      // O segmento em curso é abandonado; a espera em fila já foi fechada por PopQueue
+      segmentStart[id] = -1.0;
+      WriteTraceInstant(f, r->where, "timeout", id, r->time);
+      break;
+    case TRACE_DONE:
+      WriteTraceInstant(f, r->where, "concluida", id, r->time);
+      break;
+    case TRACE_DROPPED:
+      segmentStart[id] = -1.0;
+      WriteTraceInstant(f, r->where, "descartada", id, r->time);
+      break;
+    }
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  free(segmentStart);
+  free(queueStart);
+  return traceWritten - first;
+}
+
+//====================================================================================
+// ALOCAÇÃO DE SLOTS DE MENSAGENS
+//====================================================================================
+
+void GrowMessageStore(int capacity)
+{
+  MessageStore *st = &msgs;
+  st->state = GrowColumn(st->state, sizeof(*st->state), capacity);
+  st->segmentStartTime = GrowColumn(st->segmentStartTime, sizeof(*st->segmentStartTime), capacity);
+  st->segmentEdge = GrowColumn(st->segmentEdge, sizeof(*st->segmentEdge), capacity);
+  st->currentSegment = GrowColumn(st->currentSegment, sizeof(*st->currentSegment), capacity);
+  st->currentAckSegment = GrowColumn(st->currentAckSegment, sizeof(*st->currentAckSegment), capacity);
+  st->sendEpoch = GrowColumn(st->sendEpoch, sizeof(*st->sendEpoch), capacity);
+  st->queuedAtNodeId = GrowColumn(st->queuedAtNodeId, sizeof(*st->queuedAtNodeId), capacity);
+  st->queuedEdge = GrowColumn(st->queuedEdge, sizeof(*st->queuedEdge), capacity);
+  st->queuePrev = GrowColumn(st->queuePrev, sizeof(*st->queuePrev), capacity);
+  st->queueNext = GrowColumn(st->queueNext, sizeof(*st->queueNext), capacity);
+  st->queueSeq = GrowColumn(st->queueSeq, sizeof(*st->queueSeq), capacity);
+  st->from = GrowColumn(st->from, sizeof(*st->from), capacity);
+  st->to = GrowColumn(st->to, sizeof(*st->to), capacity);
+  st->route = GrowColumn(st->route, sizeof(*st->route), capacity);
+  st->ackRoute = GrowColumn(st->ackRoute, sizeof(*st->ackRoute), capacity);
+  st->routeEpochSeen = GrowColumn(st->routeEpochSeen, sizeof(*st->routeEpochSeen), capacity);
+  st->timeoutTimer = GrowColumn(st->timeoutTimer, sizeof(*st->timeoutTimer), capacity);
+  st->generation = GrowColumn(st->generation, sizeof(*st->generation), capacity);
+  st->activeIndex = GrowColumn(st->activeIndex, sizeof(*st->activeIndex), capacity);
+  st->creation_time = GrowColumn(st->creation_time, sizeof(*st->creation_time), capacity);
+  st->sendTime = GrowColumn(st->sendTime, sizeof(*st->sendTime), capacity);
+  st->retransmission_count = GrowColumn(st->retransmission_count, sizeof(*st->retransmission_count), capacity);
+  activeMessages = GrowColumn(activeMessages, sizeof(*activeMessages), capacity);
+  st->capacity = capacity;
+}
+
+// Retorna um slot livre (reciclado ou novo), ou -1 se MAX_MESSAGES estão em uso.
+int AllocMessageSlot(void)
+{
+  if (msgs.freeHead != -1)
+  {
+    int id = msgs.freeHead;
+    msgs.freeHead = msgs.queueNext[id];
+    return id;
+  }
+  if (msgs.slotCount >= msgs.capacity)
+  {
+    if (msgs.capacity >= MAX_MESSAGES)
+      return -1;
+    int newCapacity = msgs.capacity ? msgs.capacity * 2 : 1024;
+    GrowMessageStore(newCapacity > MAX_MESSAGES ? MAX_MESSAGES : newCapacity);
+  }
+  int id = msgs.slotCount++;
+  msgs.sendEpoch[id] = 0;
+  msgs.generation[id] = 0;
+  msgs.route[id] = msgs.ackRoute[id] = -1;
+  return id;
+}
+
+void FreeMessageSlot(int id)
+{
+  msgs.generation[id]++;
+  msgs.queueNext[id] = msgs.freeHead;
+  msgs.freeHead = id;
+}
+
+MessageHandle GetMessageHandle(int id)
+{
+  return (MessageHandle){id, msgs.generation[id]};
+}
+
+// Resolve um handle para o slot; retorna -1 se a mensagem já foi concluída e o slot reciclado.
+int GetMessageSlot(MessageHandle h)
+{
+  if (h.index < 0 || h.index >= msgs.slotCount || msgs.generation[h.index] != h.generation)
+    return -1;
+  return h.index;
+}
+
+void AddActiveMessage(int id)
+{
+  msgs.activeIndex[id] = activeCount;
+  activeMessages[activeCount++] = id;
+}
+
+void RemoveActiveMessage(int id)
+{
+  int index = msgs.activeIndex[id];
+  int last = activeMessages[--activeCount];
+  activeMessages[index] = last;
+  msgs.activeIndex[last] = index;
+  msgs.activeIndex[id] = -1;
+}
+
+// Fração [0,1] do segmento atual já percorrida, derivada do relógio da simulação.
+float MessageProgress(int id)
+{
+  float progress = (float)((simTime - msgs.segmentStartTime[id]) * messageSpeed);
+  if (progress < 0.0f)
+    return 0.0f;
+  return progress > 1.0f ? 1.0f : progress;
+}
+
+// Fecha os intervalos ocupado e saturado até agora e os reabre se a aresta
+// continua assim. Chamar de novo no mesmo instante não soma nada, então a
+// ordem não importa.
+static void SettleEdgeBusy(EdgeState *es)
+{
+  int load = es->load;
+  if (es->busySince >= 0.0)
+    es->busySeconds += simTime - es->busySince;
+  es->busySince = load > 0 ? simTime : -1.0;
+  if (es->saturatedSince >= 0.0)
+    es->saturatedSeconds += simTime - es->saturatedSince;
+  es->saturatedSince = load >= es->capacity ? simTime : -1.0;
+  if (load > es->intervalPeak)
+    es->intervalPeak = load;
+  if (load > es->peakLoad)
+    es->peakLoad = load;
+}
+
+// Fecha o período atual de todas as arestas vivas numa nova posição dos anéis.
+void SampleLinks(void)
+{
+  int slot = linkSampleHead;
+  for (int e = 0; e < graph.edgeCount; e++)
+  {
+    if (!graph.edgeAlive[e])
+      continue;
+    EdgeState *es = &edgeState[e];
+    SettleEdgeBusy(es);
+    long long carried = es->messagesCarried;
+    linkSamples[e * LINK_SAMPLE_COUNT + slot] = (LinkSample){
+        .busy = (float)((es->busySeconds - es->sampledBusy) / LINK_SAMPLE_SECONDS),
+        .saturated = (float)((es->saturatedSeconds - es->sampledSaturated) / LINK_SAMPLE_SECONDS),
+        .carried = (int)(carried - es->sampledCarried),
+        .peak = es->intervalPeak,
+    };
+    es->sampledBusy = es->busySeconds;
+    es->sampledSaturated = es->saturatedSeconds;
+    es->sampledCarried = carried;
+    es->intervalPeak = es->load;
+  }
+  linkSampleHead = (slot + 1) % LINK_SAMPLE_COUNT;
+  linkSampleSerial++;
+  if (linkSampleCount < LINK_SAMPLE_COUNT)
+    linkSampleCount++;
+}
+
+// Amostra de 'edge' de 'age' períodos atrás (0 = a mais recente). age < linkSampleCount.
+LinkSample LinkSampleAt(int edge, int age)
+{
+  int slot = (linkSampleHead - 1 - age + 2 * LINK_SAMPLE_COUNT) % LINK_SAMPLE_COUNT;
+  return linkSamples[edge * LINK_SAMPLE_COUNT + slot];
+}
+
+// Ocupa a aresta. Uma aresta que sai de zero bloqueia a pista oposta, o que
+// AcquireRoute confere ao reutilizar uma rota; não cria caminhos, então não
+// muda routeEpoch.
+void AcquireLink(int edge)
+{
+  EdgeState *es = &edgeState[edge];
+  es->messagesCarried++;
+  es->load++;
+  SettleEdgeBusy(es);
+}
+
+// Libera a aresta. Se há mensagens na fila dela, o nó de origem é acordado
+// para entregar a vaga à cabeça da fila.
+void ReleaseLink(int edge)
+{
+  EdgeState *es = &edgeState[edge];
+  if (es->load > 0 && --es->load == 0)
+    InvalidateRoutes();
+  SettleEdgeBusy(es);
+  if (es->queueHead != -1)
+    WakeNode(graph.edgeFrom[edge]);
+}
+
+bool LinkHasRoom(int edge)
+{
+  return edgeState[edge].load < edgeState[edge].capacity;
+}
+
+// Agenda a chegada ao fim do segmento que começa agora.
+void StartSegment(int id, int edge)
+{
+  msgs.segmentEdge[id] = edge;
+  msgs.segmentStartTime[id] = simTime;
+  TraceEvent(TRACE_SEGMENT_START, id, edge);
+  ScheduleEvent(simTime + 1.0 / messageSpeed, EVENT_HOP_ARRIVAL, id, msgs.sendEpoch[id]);
+}
+
+// Aresta de saída da mensagem parada em 'nodeId'. Na origem e no destino a rota é
+// (re)calculada com AcquireRoute; no meio do caminho ela é fixa. Retorna -1 sem
+// rota, ou se a ligação do caminho fixo foi removida.
+int NextLinkAt(int id, int nodeId)
+{
+  if (nodeId == msgs.from[id])
+  {
+    SetRoute(&msgs.route[id], AcquireRoute(msgs.from[id], msgs.to[id]));
+    msgs.routeEpochSeen[id] = routeEpoch;
+    msgs.currentSegment[id] = 0;
+    return RouteLength(msgs.route[id]) > 1 ? FindEdge(nodeId, RouteHop(msgs.route[id], 1)) : -1;
+  }
+  if (nodeId == msgs.to[id])
+  {
+    SetRoute(&msgs.ackRoute[id], AcquireRoute(msgs.to[id], msgs.from[id]));
+    msgs.routeEpochSeen[id] = routeEpoch;
+    msgs.currentAckSegment[id] = 0;
+    return RouteLength(msgs.ackRoute[id]) > 1 ? FindEdge(nodeId, RouteHop(msgs.ackRoute[id], 1)) : -1;
+  }
+  // No meio do caminho: ackRoute só é definido ao sair do destino
+  if (msgs.ackRoute[id] != -1)
+    return FindEdge(nodeId, RouteHop(msgs.ackRoute[id], msgs.currentAckSegment[id] + 1));
+  return FindEdge(nodeId, RouteHop(msgs.route[id], msgs.currentSegment[id] + 1));
+}
+
+// Uma mensagem parada na origem ou no destino só refaz a rota se o routeEpoch
+// mudou desde o último cálculo (um caminho mais curto pode ter aberto) ou se
+// uma pista contrária da rota atual foi ocupada; fora isso a busca devolveria
+// a mesma rota.
+static bool RouteNeedsCheck(int id, int nodeId)
+{
+  if (nodeId != msgs.from[id] && nodeId != msgs.to[id])
+    return false;
+  int r = nodeId == msgs.from[id] ? msgs.route[id] : msgs.ackRoute[id];
+  return msgs.routeEpochSeen[id] != routeEpoch || r == -1 || !RouteLanesIdle(r);
+}
+
+static void QueueEnds(int nodeId, int edge, int **head, int **tail)
+{
+  if (edge == -1)
+  {
+    *head = &routeWaitHead[nodeId];
+    *tail = &routeWaitTail[nodeId];
+  }
+  else
+  {
+    *head = &edgeState[edge].queueHead;
+    *tail = &edgeState[edge].queueTail;
+  }
+}
+
+static QueueKind QueueKindAt(int id, int nodeId)
+{
+  if (nodeId == msgs.from[id])
+    return QUEUE_ORIGIN;
+  if (nodeId == msgs.to[id])
+    return QUEUE_ACK;
+  return QUEUE_INTERMEDIATE;
+}
+
+// Mensagens paradas em 'nodeId' no papel 'kind', mantido a cada entrada e saída de QUEUED.
+int QueuedAtNode(int nodeId, QueueKind kind)
+{
+  return nodeQueuedByKind[nodeId][kind];
+}
+
+// Coloca a mensagem no fim da fila da aresta (ou da espera por rota, com edge == -1).
+void PushQueue(int id, int nodeId, int edge)
+{
+  int *head, *tail;
+  QueueEnds(nodeId, edge, &head, &tail);
+  if (edge == -1 && *head == -1)
+  {
+    routeWaitNodeIndex[nodeId] = routeWaitNodeCount;
+    routeWaitNodes[routeWaitNodeCount++] = nodeId;
+  }
+  if (edge == -1)
+    routeWaitCount++;
+  msgs.state[id] = QUEUED;
+  msgs.queuedAtNodeId[id] = nodeId;
+  msgs.queuedEdge[id] = edge;
+  msgs.queueSeq[id] = nextQueueSeq++;
+  msgs.queueNext[id] = -1;
+  msgs.queuePrev[id] = *tail;
+  if (*tail != -1)
+    msgs.queueNext[*tail] = id;
+  else
+    *head = id;
+  *tail = id;
+  TraceEvent(TRACE_QUEUED, id, nodeId);
+  nodeQueuedCount[nodeId]++;
+  QueueKind kind = QueueKindAt(id, nodeId);
+  nodeQueuedByKind[nodeId][kind]++;
+  queuedByKind[kind]++;
+}
+
+void PopQueue(int id)
+{
+  int nodeId = msgs.queuedAtNodeId[id];
+  TraceEvent(TRACE_DEQUEUED, id, nodeId);
+  int *head, *tail;
+  QueueEnds(nodeId, msgs.queuedEdge[id], &head, &tail);
+  if (msgs.queuePrev[id] != -1)
+    msgs.queueNext[msgs.queuePrev[id]] = msgs.queueNext[id];
+  else
+    *head = msgs.queueNext[id];
+  if (msgs.queueNext[id] != -1)
+    msgs.queuePrev[msgs.queueNext[id]] = msgs.queuePrev[id];
+  else
+    *tail = msgs.queuePrev[id];
+  if (msgs.queuedEdge[id] == -1)
+    routeWaitCount--;
+  if (msgs.queuedEdge[id] == -1 && *head == -1)
+  {
+    int index = routeWaitNodeIndex[nodeId];
+    int last = routeWaitNodes[--routeWaitNodeCount];
+    routeWaitNodes[index] = last;
+    routeWaitNodeIndex[last] = index;
+    routeWaitNodeIndex[nodeId] = -1;
+  }
+  nodeQueuedCount[nodeId]--;
+  QueueKind kind = QueueKindAt(id, nodeId);
+  nodeQueuedByKind[nodeId][kind]--;
+  queuedByKind[kind]--;
+  msgs.queuedAtNodeId[id] = -1;
+  msgs.queuePrev[id] = msgs.queueNext[id] = -1;
+}
+
+// Troca a mensagem de fila no mesmo nó mantendo sua ordem de chegada.
+void MoveQueue(int id, int edge)
+{
+  int nodeId = msgs.queuedAtNodeId[id];
+  unsigned long long seq = msgs.queueSeq[id];
+  PopQueue(id);
+  PushQueue(id, nodeId, edge);
+  msgs.queueSeq[id] = seq;
+}
+
+void EnqueueAtNode(int id, int nodeId)
+{
+  PushQueue(id, nodeId, NextLinkAt(id, nodeId));
+  WakeNode(nodeId);
+}
+
+void ScheduleNodeRelease(int nodeId, double t)
+{
+  if (nodeReleasePending[nodeId])
+    return;
+  nodeReleasePending[nodeId] = true;
+  ScheduleEvent(t > simTime ? t : simTime, EVENT_NODE_RELEASE, nodeId, 0);
+}
+
+// Agenda uma tentativa de liberação no nó assim que o intervalo de liberação permitir.
+void WakeNode(int nodeId)
+{
+  if (nodeQueuedCount[nodeId] > 0)
+    ScheduleNodeRelease(nodeId, nodeReleaseReadyTime[nodeId]);
+}
+
+// Prazo do envio atual, como o RTO do TCP: SRTT + 4 * RTTVAR, nunca abaixo de
+// timeoutSeconds, dobrado a cada retransmissão da mensagem. Com um prazo fixo,
+// sob carga pesada as filas passam dele, cada timeout reinjeta a mensagem na
+// origem e a rede colapsa em retransmissões.
+float RetransmissionTimeout(int id)
+{
+  double rto = timeoutSeconds;
+  if (rttSmoothed >= 0.0 && rttSmoothed + 4 * rttVariance > rto)
+    rto = rttSmoothed + 4 * rttVariance;
+  int backoff = msgs.retransmission_count[id];
+  if (backoff > TIMEOUT_BACKOFF_MAX)
+    backoff = TIMEOUT_BACKOFF_MAX;
+  return (float)(rto * (1 << backoff));
+}
+
+// Tira a mensagem do nó pela aresta 'edge', que tem vaga. Da origem, arma o
+// prazo de retransmissão do envio.
+static void DepartNode(int id, int nodeId, int edge)
+{
+  msgs.state[id] = msgs.ackRoute[id] != -1 ? ACK_RECEIVING : SENDING;
+  AcquireLink(edge);
+  if (nodeId == msgs.from[id])
+  {
+    msgs.sendTime[id] = simTime;
+    msgs.timeoutTimer[id] = ArmTimer(&timerWheel, simTime, RetransmissionTimeout(id), TIMER_MESSAGE_TIMEOUT, id);
+  }
+  StartSegment(id, edge);
+}
+
+// Segue com a mensagem que acabou de chegar (ou nascer) em 'nodeId' rumo à
+// aresta 'edge' (-1 sem rota). Com vaga e fila vazia ela parte já. Com vaga e
+// fila, ela entra no fim e a vaga vai para a cabeça, que chegou antes; sem
+// vaga, espera a liberação do nó.
+void ContinueAtNode(int id, int nodeId, int edge)
+{
+  if (edge != -1 && LinkHasRoom(edge))
+  {
+    int head = edgeState[edge].queueHead;
+    if (head == -1)
+    {
+      DepartNode(id, nodeId, edge);
+      return;
+    }
+    PushQueue(id, nodeId, edge);
+    // Cabeças cuja rota mudou passam para a fila certa do nó
+    while (head != -1 && RouteNeedsCheck(head, nodeId))
+    {
+      int current = NextLinkAt(head, nodeId);
+      if (current == edge)
+        break;
+      MoveQueue(head, current);
+      head = edgeState[edge].queueHead;
+    }
+    if (head != -1)
+    {
+      PopQueue(head);
+      DepartNode(head, nodeId, edge);
+    }
+  }
+  else
+    PushQueue(id, nodeId, edge);
+  WakeNode(nodeId);
+}
+
+MessageHandle AddAsyncMessage(int from, int to)
+{
+  int id = AllocMessageSlot();
+  if (id == -1)
+    return INVALID_MESSAGE_HANDLE;
+  sent_messages_count++;
+  // sendEpoch e generation continuam de onde o ocupante anterior parou,
+  // invalidando seus eventos pendentes e handles antigos
+  msgs.from[id] = from;
+  msgs.to[id] = to;
+  msgs.currentSegment[id] = msgs.currentAckSegment[id] = 0;
+  msgs.queuedAtNodeId[id] = msgs.queuedEdge[id] = -1;
+  msgs.queuePrev[id] = msgs.queueNext[id] = -1;
+  msgs.timeoutTimer[id] = -1;
+  msgs.retransmission_count[id] = 0;
+  msgs.creation_time[id] = simTime;
+  TraceEvent(TRACE_CREATED, id, from);
+
+  AddActiveMessage(id);
+  msgs.route[id] = AcquireRoute(from, to);
+  msgs.routeEpochSeen[id] = routeEpoch;
+  int firstLink = RouteLength(msgs.route[id]) > 1 ? FindEdge(from, RouteHop(msgs.route[id], 1)) : -1;
+  ContinueAtNode(id, from, firstLink);
+  return GetMessageHandle(id);
+}
+
+// Reavalia a rota das mensagens do nó que estavam sem caminho, movendo para a
+// fila do enlace as que agora têm rota. Revisões que não liberam ninguém dobram
+// o intervalo até a próxima, já que cada uma custa uma busca por mensagem.
+void RetryRouteWaiters(int nodeId)
+{
+  nodeRouteEpochSeen[nodeId] = routeEpoch;
+  bool moved = false;
+  int id = routeWaitHead[nodeId];
+  while (id != -1)
+  {
+    int following = msgs.queueNext[id];
+    int edge = NextLinkAt(id, nodeId);
+    if (edge != -1)
+    {
+      MoveQueue(id, edge);
+      moved = true;
+    }
+    id = following;
+  }
+  if (moved)
+    nodeRouteRetryBackoff[nodeId] = 0;
+  else if (nodeRouteRetryBackoff[nodeId] < ROUTE_RETRY_BACKOFF_MAX)
+    nodeRouteRetryBackoff[nodeId]++;
+  nodeRouteRetryTime[nodeId] = simTime + releaseInterval * (1 << nodeRouteRetryBackoff[nodeId]);
+}
+
+// Libera no máximo uma mensagem do nó, respeitando o intervalo de liberação:
+// entre os enlaces de saída com vaga, parte a cabeça de fila mais antiga. Se
+// nenhuma puder partir, o nó fica parado até ReleaseLink, um novo
+// enfileiramento ou uma mudança de rota.
+void ProcessNodeRelease(int nodeId)
+{
+  nodeReleasePending[nodeId] = false;
+  if (simTime < nodeReleaseReadyTime[nodeId])
+  {
+    WakeNode(nodeId);
+    return;
+  }
+  bool routesStale = routeWaitHead[nodeId] != -1 && nodeRouteEpochSeen[nodeId] != routeEpoch;
+  if (routesStale && simTime >= nodeRouteRetryTime[nodeId])
+  {
+    RetryRouteWaiters(nodeId);
+    routesStale = false;
+  }
+
+  EnsureAdjacency();
+  while (1)
+  {
+    int best = -1;
+    for (int k = graph.adjOffset[nodeId]; k < graph.adjOffset[nodeId + 1]; k++)
+    {
+      int edge = graph.adjEdge[k];
+      int head = edgeState[edge].queueHead;
+      if (head != -1 && LinkHasRoom(edge) && (best == -1 || msgs.queueSeq[head] < msgs.queueSeq[best]))
+        best = head;
+    }
+    if (best == -1)
+      break;
+
+    int edge = msgs.queuedEdge[best];
+    // Na origem e no destino a rota pode ter mudado desde o enfileiramento
+    if (RouteNeedsCheck(best, nodeId))
+    {
+      int current = NextLinkAt(best, nodeId);
+      if (current != edge)
+      {
+        MoveQueue(best, current);
+        continue;
+      }
+    }
+
+    PopQueue(best);
+    DepartNode(best, nodeId, edge);
+    nodeReleaseReadyTime[nodeId] = simTime + releaseInterval;
+    WakeNode(nodeId);
+    return;
+  }
+  if (routesStale)
+    ScheduleNodeRelease(nodeId, nodeRouteRetryTime[nodeId]);
+}
+
+// Recicla o slot de uma mensagem encerrada, concluída ou descartada.
+static void RetireMessage(int id)
+{
+  msgs.state[id] = DONE;
+  msgs.sendEpoch[id]++;
+  CancelTimer(&timerWheel, msgs.timeoutTimer[id]);
+  msgs.timeoutTimer[id] = -1;
+  SetRoute(&msgs.route[id], -1);
+  SetRoute(&msgs.ackRoute[id], -1);
+  RemoveActiveMessage(id);
+  FreeMessageSlot(id);
+}
+
+// Encerra a mensagem que voltou à origem com o ACK e recicla o slot.
+void FinishMessage(int id)
+{
+  TraceEvent(TRACE_DONE, id, msgs.from[id]);
+  RetireMessage(id);
+}
+
+void ProcessHopArrival(int id)
+{
+  bool ackLeg = msgs.state[id] == ACK_RECEIVING;
+  int route = ackLeg ? msgs.ackRoute[id] : msgs.route[id];
+  int *segment = ackLeg ? &msgs.currentAckSegment[id] : &msgs.currentSegment[id];
+
+  int currentNodeId = graph.edgeTo[msgs.segmentEdge[id]];
+  TraceEvent(TRACE_SEGMENT_END, id, msgs.segmentEdge[id]);
+  (*segment)++;
+  ReleaseLink(msgs.segmentEdge[id]);
+
+  if (!ackLeg && currentNodeId == msgs.to[id])
+  {
+    EnqueueAtNode(id, msgs.to[id]);
+    return;
+  }
+  if (ackLeg && currentNodeId == msgs.from[id])
+  {
+    total_latency_seconds += simTime - msgs.creation_time[id];
+    completed_messages_count++;
+    RecordCompletion(id);
+    FinishMessage(id);
+    return;
+  }
+  // -1 se a ligação do caminho foi removida: a mensagem espera pelo timeout
+  ContinueAtNode(id, currentNodeId, FindEdge(currentNodeId, RouteHop(route, *segment + 1)));
+}
+
+void ProcessTimeout(int id)
+{
+  if (logTimeouts)
+    printf("!!! TIMEOUT da Mensagem %d (%d->%d) !!!\n", id, msgs.from[id], msgs.to[id]);
+  TraceEvent(TRACE_TIMEOUT, id, msgs.from[id]);
+  total_retransmissions++;
+  msgs.timeoutTimer[id] = -1;
+
+  if (msgs.state[id] == SENDING || msgs.state[id] == ACK_RECEIVING)
+    ReleaseLink(msgs.segmentEdge[id]);
+  else if (msgs.state[id] == QUEUED)
+    PopQueue(id);
+
+  msgs.sendEpoch[id]++;
+  msgs.retransmission_count[id]++;
+  SetRoute(&msgs.route[id], -1);
+  SetRoute(&msgs.ackRoute[id], -1);
+  msgs.currentSegment[id] = 0;
+  msgs.currentAckSegment[id] = 0;
+  EnqueueAtNode(id, msgs.from[id]);
+}
+
+// Antes de desfazer a criação de 'nodeId': as mensagens que nascem ou terminam
+// nele são descartadas, e as que estão paradas nele ou a caminho dele voltam à
+// origem como num timeout. Assim nenhuma fila fica presa ao nó, cujo índice
+// será reutilizado pelo próximo AddNode.
+void DropMessagesAtNode(int nodeId)
+{
+  for (int i = activeCount - 1; i >= 0; i--)
+  {
+    int id = activeMessages[i];
+    bool queuedHere = msgs.state[id] == QUEUED && msgs.queuedAtNodeId[id] == nodeId;
+    bool travelingHere = msgs.state[id] != QUEUED && graph.edgeTo[msgs.segmentEdge[id]] == nodeId;
+    if (msgs.from[id] == nodeId || msgs.to[id] == nodeId)
+    {
+      if (msgs.state[id] == QUEUED)
+        PopQueue(id);
+      else
+        ReleaseLink(msgs.segmentEdge[id]);
+      TraceEvent(TRACE_DROPPED, id, msgs.from[id]);
+      RetireMessage(id);
+    }
+    else if (queuedHere || travelingHere)
+    {
+      CancelTimer(&timerWheel, msgs.timeoutTimer[id]);
+      ProcessTimeout(id);
+    }
+  }
+}
+
+// Quando a regra da pista oposta muda, as mensagens sem rota podem ter ganhado uma.
+void WakeRouteWaiters(void)
+{
+  routesChanged = false;
+  for (int i = 0; i < routeWaitNodeCount; i++)
+    WakeNode(routeWaitNodes[i]);
+}
+
+void FireTimer(TimerKind kind, int id)
+{
+  switch (kind)
+  {
+  case TIMER_MESSAGE_TIMEOUT:
+    ProcessTimeout(id);
+    break;
+  }
+}
+
+//====================================================================================
+// PASSO PARALELO
+//====================================================================================
+// As chegadas de salto são processadas em fatias de tempo de até um segmento
+// (1 / messageSpeed): os workers liberam a aresta atual e reservam a próxima
+// com operações atômicas em edgeLoadDelta (só leem rotas, o grafo e
+// edgeState), e a thread do motor aplica o resto em ordem de agendamento,
+// intercalando as liberações de nó que caem dentro da fatia. Como as reservas
+// da fatia são decididas juntas, a ordem em que as vagas de uma aresta são
+// concedidas dentro dela pode diferir da sequencial; a capacidade nunca é
+// ultrapassada. Com simThreads == 1 o motor continua totalmente sequencial.
+
+typedef enum HopOutcome
+{
+  HOP_ADVANCE,        // Reservou a próxima aresta
+  HOP_QUEUE,          // Próxima aresta cheia (ou removida): entra na fila do nó
+  HOP_AT_DESTINATION, // Chegou ao destino: o ACK é roteado pela thread do motor
+  HOP_DONE            // ACK voltou à origem
+} HopOutcome;
+
+// Estatísticas parciais de um worker, somadas às globais ao fim do lote
+typedef struct WorkerStats
+{
+  _Alignas(64) int completed; // Uma linha de cache por worker
+  double latencySeconds;
+  bool routesChanged;
+} WorkerStats;
+
+typedef struct HopBatch
+{
+  int *ids;
+  double *time;           // Instante de cada chegada, em ordem crescente
+  unsigned char *outcome; // HopOutcome
+  int *nextEdge;
+  int count, capacity;
+} HopBatch;
+
+typedef struct WorkerPool
+{
+  pthread_t *threads;
+  int threadCount; // Inclui a thread do motor
+  pthread_mutex_t mutex;
+  pthread_cond_t wake, idle;
+  unsigned long long generation; // Incrementada a cada lote publicado
+  int busy;                      // Workers que ainda não terminaram o lote atual
+  WorkerStats *stats;
+} WorkerPool;
+
+int simThreads = 1; // Threads do passo paralelo (--threads no modo headless)
+WorkerPool workerPool = {.mutex = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .idle = PTHREAD_COND_INITIALIZER};
+HopBatch hopBatch;
+
+// Reserva uma vaga na aresta com compare-and-swap, sem nunca passar da
+// capacidade. load fica fixo durante o lote; só a variação é disputada.
+static bool ReserveLink(int edge)
+{
+  const EdgeState *es = &edgeState[edge];
+  if (es->queueHead != -1) // Com fila, a vaga é da cabeça: decide a thread do motor
+    return false;
+  int delta = atomic_load_explicit(&edgeLoadDelta[edge], memory_order_relaxed);
+  do
+  {
+    if (es->load + delta >= es->capacity)
+      return false;
+  } while (!atomic_compare_exchange_weak_explicit(&edgeLoadDelta[edge], &delta, delta + 1, memory_order_relaxed, memory_order_relaxed));
+  return true;
+}
+
+// Soma em load a variação acumulada pelo lote (só na thread do motor).
+static void ApplyLoadDelta(int edge)
+{
+  int delta = atomic_load_explicit(&edgeLoadDelta[edge], memory_order_relaxed);
+  if (delta != 0)
+  {
+    edgeState[edge].load += delta;
+    atomic_store_explicit(&edgeLoadDelta[edge], 0, memory_order_relaxed);
+  }
+}
+
+// Parte atômica de ProcessHopArrival para a fatia do lote deste worker.
+static void ProcessHopSlice(int worker)
+{
+  int share = (hopBatch.count + workerPool.threadCount - 1) / workerPool.threadCount;
+  int begin = worker * share;
+  int end = begin + share < hopBatch.count ? begin + share : hopBatch.count;
+  WorkerStats *ws = &workerPool.stats[worker];
+  for (int i = begin; i < end; i++)
+  {
+    int id = hopBatch.ids[i];
+    bool ackLeg = msgs.state[id] == ACK_RECEIVING;
+    int route = ackLeg ? msgs.ackRoute[id] : msgs.route[id];
+    int *segment = ackLeg ? &msgs.currentAckSegment[id] : &msgs.currentSegment[id];
+    int edge = msgs.segmentEdge[id];
+    int currentNodeId = graph.edgeTo[edge];
+    (*segment)++;
+    if (edgeState[edge].load + atomic_fetch_sub_explicit(&edgeLoadDelta[edge], 1, memory_order_relaxed) == 1)
+      ws->routesChanged = true;
+
+    if (!ackLeg && currentNodeId == msgs.to[id])
+      hopBatch.outcome[i] = HOP_AT_DESTINATION;
+    else if (ackLeg && currentNodeId == msgs.from[id])
+    {
+      ws->completed++;
+      ws->latencySeconds += hopBatch.time[i] - msgs.creation_time[id];
+      hopBatch.outcome[i] = HOP_DONE;
+    }
+    else
+    {
+      int next = FindEdge(currentNodeId, RouteHop(route, *segment + 1));
+      hopBatch.nextEdge[i] = next;
+      hopBatch.outcome[i] = next != -1 && ReserveLink(next) ? HOP_ADVANCE : HOP_QUEUE;
+    }
+  }
+}
+
+static void *WorkerMain(void *arg)
+{
+  int worker = (int)(intptr_t)arg;
+  unsigned long long seen = 0;
+  pthread_mutex_lock(&workerPool.mutex);
+  while (1)
+  {
+    while (workerPool.generation == seen)
+      pthread_cond_wait(&workerPool.wake, &workerPool.mutex);
+    seen = workerPool.generation;
+    pthread_mutex_unlock(&workerPool.mutex);
+    ProcessHopSlice(worker);
+    pthread_mutex_lock(&workerPool.mutex);
+    if (--workerPool.busy == 0)
+      pthread_cond_signal(&workerPool.idle);
+  }
+  return NULL;
+}
+
+// Cria os workers do passo paralelo; eles vivem até o fim do processo.
+void StartWorkerPool(int threadCount)
+{
+  if (threadCount <= 1 || workerPool.threadCount > 0)
+  {
+    // O pool não muda de tamanho depois de criado
+    simThreads = threadCount <= 1 ? 1 : workerPool.threadCount;
+    return;
+  }
+  workerPool.threads = GrowColumn(NULL, sizeof(pthread_t), threadCount);
+  workerPool.stats = GrowColumn(NULL, sizeof(WorkerStats), threadCount);
+  workerPool.threadCount = threadCount;
+  for (int i = 1; i < threadCount; i++)
+  {
+    if (pthread_create(&workerPool.threads[i], NULL, WorkerMain, (void *)(intptr_t)i) != 0)
+    {
+      fprintf(stderr, "Falha ao criar a thread %d do passo paralelo\n", i);
+      exit(1);
+    }
+    pthread_detach(workerPool.threads[i]);
+  }
+  simThreads = threadCount;
+}
+
+// Retira do heap as chegadas de salto válidas com instante antes de 'end' (e
+// até 'until'), em ordem de agendamento. Para no primeiro evento de outro tipo.
+static void CollectHopBatch(double end, double until)
+{
+  hopBatch.count = 0;
+  while (eventQueue.count > 0 && eventQueue.items[0].type == EVENT_HOP_ARRIVAL &&
+         eventQueue.items[0].time < end && eventQueue.items[0].time <= until)
+  {
+    SimEvent ev = PopEvent();
+    engine_events_processed++;
+    if (ev.stamp != msgs.sendEpoch[ev.id] || msgs.state[ev.id] == QUEUED)
+      continue;
+    if (hopBatch.count == hopBatch.capacity)
+    {
+      int capacity = hopBatch.capacity ? hopBatch.capacity * 2 : 1024;
+      hopBatch.ids = GrowColumn(hopBatch.ids, sizeof(*hopBatch.ids), capacity);
+      hopBatch.time = GrowColumn(hopBatch.time, sizeof(*hopBatch.time), capacity);
+      hopBatch.outcome = GrowColumn(hopBatch.outcome, sizeof(*hopBatch.outcome), capacity);
+      hopBatch.nextEdge = GrowColumn(hopBatch.nextEdge, sizeof(*hopBatch.nextEdge), capacity);
+      hopBatch.capacity = capacity;
+    }
+    hopBatch.time[hopBatch.count] = ev.time;
+    hopBatch.ids[hopBatch.count++] = ev.id;
+  }
+}
+
+static void DispatchEvent(SimEvent ev)
+{
+  simTime = ev.time;
+  engine_events_processed++;
+  switch (ev.type)
+  {
+  case EVENT_HOP_ARRIVAL:
+    if (ev.stamp == msgs.sendEpoch[ev.id] && msgs.state[ev.id] != QUEUED)
+      ProcessHopArrival(ev.id);
+    break;
+  case EVENT_NODE_RELEASE:
+    ProcessNodeRelease(ev.id);
+    break;
+  }
+  if (routesChanged)
+    WakeRouteWaiters();
+}
+
+// Leva o relógio até a chegada 'i' do lote, processando antes as liberações
+// de nó que as chegadas anteriores agendaram para antes dela.
+static void AdvanceBatchClock(int i)
+{
+  while (eventQueue.count > 0 && eventQueue.items[0].time < hopBatch.time[i])
+    DispatchEvent(PopEvent());
+  simTime = hopBatch.time[i];
+}
+
+// Divide o lote entre os workers e depois aplica filas, eventos e conclusões
+// na ordem original. Lotes pequenos seguem pelo caminho sequencial.
+static void RunHopBatch(void)
+{
+  if (hopBatch.count < PARALLEL_BATCH_MIN)
+  {
+    for (int i = 0; i < hopBatch.count; i++)
+    {
+      AdvanceBatchClock(i);
+      ProcessHopArrival(hopBatch.ids[i]);
+      if (routesChanged)
+        WakeRouteWaiters();
+    }
+    return;
+  }
+
+  // Os workers não gravam no trace; as chegadas do lote são registradas aqui
+  if (traceRing != NULL)
+    for (int i = 0; i < hopBatch.count; i++)
+    {
+      simTime = hopBatch.time[i];
+      TraceEvent(TRACE_SEGMENT_END, hopBatch.ids[i], msgs.segmentEdge[hopBatch.ids[i]]);
+    }
+  for (int w = 0; w < workerPool.threadCount; w++)
+    workerPool.stats[w] = (WorkerStats){0};
+  pthread_mutex_lock(&workerPool.mutex);
+  workerPool.busy = workerPool.threadCount - 1;
+  workerPool.generation++;
+  pthread_cond_broadcast(&workerPool.wake);
+  pthread_mutex_unlock(&workerPool.mutex);
+  ProcessHopSlice(0);
+  pthread_mutex_lock(&workerPool.mutex);
+  while (workerPool.busy > 0)
+    pthread_cond_wait(&workerPool.idle, &workerPool.mutex);
+  pthread_mutex_unlock(&workerPool.mutex);
+
+  for (int i = 0; i < hopBatch.count; i++)
+  {
+    ApplyLoadDelta(msgs.segmentEdge[hopBatch.ids[i]]);
+    if (hopBatch.outcome[i] == HOP_ADVANCE)
+    {
+      ApplyLoadDelta(hopBatch.nextEdge[i]);
+      edgeState[hopBatch.nextEdge[i]].messagesCarried++;
+    }
+  }
+
+  bool routesMoved = false;
+  for (int w = 0; w < workerPool.threadCount; w++)
+  {
+    completed_messages_count += workerPool.stats[w].completed;
+    total_latency_seconds += workerPool.stats[w].latencySeconds;
+    routesMoved |= workerPool.stats[w].routesChanged;
+  }
+  if (routesMoved)
+    InvalidateRoutes();
+
+  for (int i = 0; i < hopBatch.count; i++)
+  {
+    AdvanceBatchClock(i);
+    int id = hopBatch.ids[i];
+    int edge = msgs.segmentEdge[id];
+    int currentNodeId = graph.edgeTo[edge];
+    SettleEdgeBusy(&edgeState[edge]);
+    if (edgeState[edge].queueHead != -1)
+      WakeNode(graph.edgeFrom[edge]);
+    int next = hopBatch.nextEdge[i];
+    switch ((HopOutcome)hopBatch.outcome[i])
+    {
+    case HOP_ADVANCE:
+      SettleEdgeBusy(&edgeState[next]);
+      StartSegment(id, next);
+      break;
+    case HOP_QUEUE:
+      ContinueAtNode(id, currentNodeId, next);
+      break;
+    case HOP_AT_DESTINATION:
+      EnqueueAtNode(id, msgs.to[id]);
+      break;
+    case HOP_DONE:
+      RecordCompletion(id);
+      FinishMessage(id);
+      break;
+    }
+    if (routesChanged)
+      WakeRouteWaiters();
+  }
+}
+
+// Processa, em ordem de tempo, todos os eventos e ticks da roda de
+// temporizadores até 'until' e avança o relógio.
+void RunEventsUntil(double until)
+{
+  while (1)
+  {
+    double tickTime = timerWheel.count > 0 ? (timerWheel.currentTick + 1) * TIMER_TICK_SECONDS : INFINITY;
+    double eventTime = eventQueue.count > 0 ? eventQueue.items[0].time : INFINITY;
+    if (tickTime <= eventTime)
+    {
+      if (tickTime > until)
+        break;
+      simTime = tickTime;
+      AdvanceTimerWheel(&timerWheel, FireTimer);
+      engine_events_processed++;
+      if (routesChanged)
+        WakeRouteWaiters();
+    }
+    else
+    {
+      if (eventTime > until)
+        break;
+      if (simThreads > 1 && eventQueue.items[0].type == EVENT_HOP_ARRIVAL)
+      {
+        // Fatia de tempo: nenhuma chegada da fatia agenda outra dentro dela,
+        // porque todo segmento dura 1 / messageSpeed, e a fatia acaba antes
+        // do próximo tick da roda de temporizadores
+        double end = eventTime + 1.0 / messageSpeed;
+        CollectHopBatch(end < tickTime ? end : tickTime, until);
+        RunHopBatch();
+        continue;
+      }
+      DispatchEvent(PopEvent());
+    }
+  }
+  if (until > simTime)
+    simTime = until;
+}
+
+// Relógio de parede em segundos, usado só para medir a velocidade do motor.
+double WallSeconds(void)
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void UpdateAsyncMessages(float dt, float interval)
+{
+  double wallStart = WallSeconds();
+  releaseInterval = interval;
+  if (routesChanged)
+    WakeRouteWaiters();
+  double until = simTime + dt;
+  while (nextLinkSampleTime <= until)
+  {
+    RunEventsUntil(nextLinkSampleTime);
+    SampleLinks();
+    nextLinkSampleTime += LINK_SAMPLE_SECONDS;
+  }
+  RunEventsUntil(until);
+  engine_wall_seconds += WallSeconds() - wallStart;
+}
+
+void SendOneBurstRound(int streamsPerRound)
+{
+  if (nodeCount == 0)
+    return;
+  for (int i = 0; i < streamsPerRound; i++)
+  {
+    int from = rand() % nodeCount;
+    int to = rand() % nodeCount;
+    while (from == to)
+    {
+      to = rand() % nodeCount;
+    }
+    AddAsyncMessage(from, to);
+  }
+}
+
+//====================================================================================
+// GERADOR DE CARGA (compartilhado entre a janela e o modo headless)
+//====================================================================================
+
+typedef struct Workload
+{
+  int messagesToSend, messageFromNode, messageToNode;
+  float messageSendTimer;
+  bool burstInProgress;
+  int burstRoundsSent, totalBurstRounds, burstSize;
+  float burstTimer, interval;
+} Workload;
+
+Workload CreateWorkload(void)
+{
+  return (Workload){.messageFromNode = -1, .messageToNode = -1, .totalBurstRounds = 10, .burstSize = 10, .interval = MESSAGE_INTERVAL};
+}
+
+// Fluxo de 'count' mensagens de 'from' para 'to', uma a cada 'interval'.
+void StartStream(Workload *w, int from, int to, int count)
+{
+  w->messagesToSend = count;
+  w->messageFromNode = from;
+  w->messageToNode = to;
+  w->messageSendTimer = w->interval;
+}
+
+void StartBurst(Workload *w)
+{
+  w->burstInProgress = true;
+  w->burstRoundsSent = 0;
+  w->burstTimer = 0.0f;
+}
+
+bool WorkloadFinished(const Workload *w)
+{
+  return w->messagesToSend <= 0 && !w->burstInProgress;
+}
+
+void UpdateWorkload(Workload *w, float dt)
+{
+  if (w->messagesToSend > 0)
+  {
+    w->messageSendTimer += dt;
+    if (w->messageSendTimer >= w->interval)
+    {
+      if (w->messageFromNode != w->messageToNode)
+        AddAsyncMessage(w->messageFromNode, w->messageToNode);
+      w->messagesToSend--;
+      w->messageSendTimer = 0.0f;
+    }
+  }
+  if (w->burstInProgress)
+  {
+    w->burstTimer += dt;
+    if (w->burstTimer >= w->interval)
+    {
+      SendOneBurstRound(w->burstSize);
+      w->burstRoundsSent++;
+      w->burstTimer = 0.0f;
+      if (w->burstRoundsSent >= w->totalBurstRounds)
+        w->burstInProgress = false;
+    }
+  }
+}
+
+//====================================================================================
+// ESTATÍSTICAS
+//====================================================================================
+
+typedef struct Statistics
+{
+  int completed;
+  float avgLatencyMs; // Latência média em tempo simulado
+  float p50Ms, p90Ms, p99Ms, p999Ms, maxLatencyMs; // Percentis do histograma de latência
+  int timeouts;
+  float throughput;   // Mensagens concluídas por segundo simulado
+  double simSeconds;
+  double engineSpeedup; // Segundos simulados por segundo real gasto no motor (0 se não medido)
+  int queued[QUEUE_KIND_COUNT]; // Mensagens paradas em filas agora, por QueueKind
+  int inFlight; // Mensagens ativas fora da espera por rota
+  int noRoute;  // Mensagens ativas paradas sem caminho até o destino (ou de volta à origem)
+} Statistics;
+
+// Todas as grandezas são em tempo simulado, portanto comparáveis entre máquinas
+// e entre os modos headless e com janela.
+Statistics ComputeStatistics(void)
+{
+  Statistics st = {.completed = completed_messages_count, .timeouts = total_retransmissions, .simSeconds = simTime};
+  if (completed_messages_count > 0)
+    st.avgLatencyMs = (float)(total_latency_seconds / completed_messages_count * 1000.0);
+  st.p50Ms = (float)(LatencyPercentile(&latencyHistogram, 50.0) * 1000.0);
+  st.p90Ms = (float)(LatencyPercentile(&latencyHistogram, 90.0) * 1000.0);
+  st.p99Ms = (float)(LatencyPercentile(&latencyHistogram, 99.0) * 1000.0);
+  st.p999Ms = (float)(LatencyPercentile(&latencyHistogram, 99.9) * 1000.0);
+  st.maxLatencyMs = (float)(latencyHistogram.maxMicros / 1000.0);
+  // Usamos um pequeno limiar para estabilizar no início
+  if (simTime > 0.1)
+    st.throughput = (float)(completed_messages_count / simTime);
+  if (engine_wall_seconds > 0.0)
+    st.engineSpeedup = simTime / engine_wall_seconds;
+  memcpy(st.queued, queuedByKind, sizeof(st.queued));
+  st.noRoute = routeWaitCount;
+  st.inFlight = activeCount - routeWaitCount;
+  return st;
+}
+
+//====================================================================================
+// SIMULAÇÃO EM THREAD PRÓPRIA (modo com janela)
+//====================================================================================
+// O motor roda em SimulationMain no seu próprio ritmo e, a cada passo, publica
+// um Snapshot imutável. A thread de desenho só lê o snapshot mais recente e
+// conversa com o motor por uma fila de comandos; nenhuma das duas espera a outra.
+
+#define SIM_STEP_SECONDS (1.0 / 120.0) // Período real entre passos da thread de simulação
+#define COMMAND_QUEUE_SIZE 256          // Potência de 2
+#define COMMAND_BACKLOG_SIZE 1024       // Comandos da janela à espera de vaga na fila
+
+// Tudo o que as funções Draw* precisam de um passo do motor
+typedef struct Snapshot
+{
+  Node *nodes;
+  int nodeCount, nodeCapacity;
+  unsigned int topologyVersion; // graph.version de nodes e links; só são recopiados quando muda
+  int *links;    // Pares (a, b) das ligações vivas
+  int *linkEdge; // Aresta a->b de cada ligação
+  float *linkDensity; // Por ligação: ocupação dos dois sentidos sobre a capacidade somada
+  float *linkUtilization; // Por ligação: maior fração ocupada dos dois sentidos na última amostra
+  float *linkSaturation;  // Por ligação: maior fração saturada dos dois sentidos na última amostra
+  unsigned int linkSampleSerial; // Amostra e topologia usadas em linkUtilization/linkSaturation
+  unsigned int linkSampleVersion;
+  int linkCount, linkCapacity;
+  bool messageLod; // Mensagens demais: só linkDensity é preenchido, não as posições
+  Vector2 *messagePos;
+  bool *messageAck; // Segmento de ACK (verde) ou de ida (vermelho)
+  int messageCount, messageCapacity;
+  int *originQueue; // Por nó: mensagens paradas na origem ou no meio do caminho
+  int *ackQueue;    // Por nó: ACKs esperando para sair do destino
+  Statistics stats;
+} Snapshot;
+
+// Três buffers: um sendo escrito pelo motor, um sendo lido pela janela e um
+// pronto para troca. snapshotReady guarda o índice do buffer pronto e
+// SNAPSHOT_FRESH quando ele ainda não foi lido.
+#define SNAPSHOT_FRESH 4
+Snapshot snapshots[3];
+_Atomic int snapshotReady = 0;
+int snapshotBack = 1;  // Só a thread de simulação usa
+int snapshotFront = 2; // Só a thread de desenho usa
+
+typedef enum CommandType
+{
+  CMD_ADD_NODE,
+  CMD_CONNECT_NODES,
+  CMD_UNDO,
+  CMD_DEFAULT_NETWORK,
+  CMD_SEND_STREAM,
+  CMD_START_BURST,
+  CMD_PRINT_STATUS,
+  CMD_TOGGLE_TRACE,
+  CMD_SAVE_TOPOLOGY,
+  CMD_LOAD_TOPOLOGY
+} CommandType;
+
+typedef struct Command
+{
+  CommandType type;
+  float x, y;
+  int a, b, count;
+} Command;
+
+// Fila circular de um produtor (janela) e um consumidor (motor)
+typedef struct CommandQueue
+{
+  Command items[COMMAND_QUEUE_SIZE];
+  _Atomic unsigned int head, tail;
+} CommandQueue;
+
+CommandQueue commandQueue;
+_Atomic bool simulationQuit = false;
+pthread_t simulationThread;
+pthread_mutex_t simulationWakeMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t simulationWake = PTHREAD_COND_INITIALIZER;
+
+void PrintNonCompletedMessages();
+
+// Acorda o motor. O sinal é dado com o mutex para não cair entre o teste da
+// fila e o pthread_cond_timedwait de SimulationMain, o que o perderia.
+static void WakeSimulation(void)
+{
+  pthread_mutex_lock(&simulationWakeMutex);
+  pthread_cond_signal(&simulationWake);
+  pthread_mutex_unlock(&simulationWakeMutex);
+}
+
+// Enfileira um comando para o motor. Retorna false se a fila estiver cheia.
+bool PostCommand(Command cmd)
+{
+  unsigned int tail = atomic_load_explicit(&commandQueue.tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&commandQueue.head, memory_order_acquire);
+  if (tail - head == COMMAND_QUEUE_SIZE)
+    return false;
+  commandQueue.items[tail & (COMMAND_QUEUE_SIZE - 1)] = cmd;
+  atomic_store_explicit(&commandQueue.tail, tail + 1, memory_order_release);
+  WakeSimulation();
+  return true;
+}
+
+// Comandos que não couberam na fila ficam aqui, na thread da janela, e são
+// reenviados a cada quadro na mesma ordem
+Command commandBacklog[COMMAND_BACKLOG_SIZE];
+int commandBacklogCount = 0;
+
+void FlushCommandBacklog(void)
+{
+  int sent = 0;
+  while (sent < commandBacklogCount && PostCommand(commandBacklog[sent]))
+    sent++;
+  memmove(commandBacklog, commandBacklog + sent, (commandBacklogCount - sent) * sizeof(Command));
+  commandBacklogCount -= sent;
+}
+
+// Envia um comando da interface sem perdê-lo quando a fila está cheia: ele
+// espera no acúmulo atrás dos anteriores. Só um acúmulo cheio descarta, e avisa.
+void SendCommand(Command cmd)
+{
+  FlushCommandBacklog();
+  if (commandBacklogCount == 0 && PostCommand(cmd))
+    return;
+  if (commandBacklogCount == COMMAND_BACKLOG_SIZE)
+  {
+    fprintf(stderr, "Fila de comandos cheia: comando %d descartado\n", (int)cmd.type);
+    return;
+  }
+  commandBacklog[commandBacklogCount++] = cmd;
+}
+
+static bool TakeCommand(Command *cmd)
+{
+  unsigned int head = atomic_load_explicit(&commandQueue.head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&commandQueue.tail, memory_order_acquire);
+  if (head == tail)
+    return false;
+  *cmd = commandQueue.items[head & (COMMAND_QUEUE_SIZE - 1)];
+  atomic_store_explicit(&commandQueue.head, head + 1, memory_order_release);
+  return true;
+}
+
+static void ApplyCommands(Workload *workload)
+{
+  Command cmd;
+  while (TakeCommand(&cmd))
+  {
+    switch (cmd.type)
+    {
+    case CMD_ADD_NODE:
+      AddNode(cmd.x, cmd.y);
+      PushAction(ACTION_ADD_NODE, nodeCount - 1, -1);
+      break;
+    case CMD_CONNECT_NODES:
+      ConnectNodes(cmd.a, cmd.b);
+      PushAction(ACTION_CONNECT_NODES, cmd.a, cmd.b);
+      break;
+    case CMD_UNDO:
+      UndoAction();
+      break;
+    case CMD_DEFAULT_NETWORK:
+      CreateDefaultNetwork();
+      break;
+    case CMD_SEND_STREAM:
+      StartStream(workload, cmd.a, cmd.b, cmd.count);
+      break;
+    case CMD_START_BURST:
+      StartBurst(workload);
+      break;
+    case CMD_PRINT_STATUS:
+      PrintNonCompletedMessages();
+      break;
+    case CMD_TOGGLE_TRACE:
+      if (traceRing == NULL)
+      {
+        StartTrace(TRACE_RING_RECORDS);
+        printf("Trace ligado\n");
+        break;
+      }
+      long long records = ExportChromeTrace(TRACE_FILE);
+      if (records >= 0)
+        printf("Trace: %lld registros em %s\n", records, TRACE_FILE);
+      StopTrace();
+      break;
+    case CMD_SAVE_TOPOLOGY:
+      if (SaveTopologyFile(TOPOLOGY_FILE))
+        printf("Topologia salva em %s\n", TOPOLOGY_FILE);
+      break;
+    case CMD_LOAD_TOPOLOGY:
+      if (LoadTopologyFile(TOPOLOGY_FILE))
+        printf("Topologia carregada de %s: %d nos\n", TOPOLOGY_FILE, nodeCount);
+      break;
+    }
+  }
+}
+
+// Copia para 's' o estado visível do motor no instante simTime.
+static void BuildSnapshot(Snapshot *s)
+{
+  if (s->topologyVersion != graph.version)
+  {
+    if (s->nodeCapacity < nodeCount)
+    {
+      s->nodes = GrowColumn(s->nodes, sizeof(*s->nodes), nodeCount);
+      s->originQueue = GrowColumn(s->originQueue, sizeof(*s->originQueue), nodeCount);
+      s->ackQueue = GrowColumn(s->ackQueue, sizeof(*s->ackQueue), nodeCount);
+      s->nodeCapacity = nodeCount;
+    }
+    s->nodeCount = nodeCount;
+    memcpy(s->nodes, nodes, nodeCount * sizeof(*nodes));
+
+    if (s->linkCapacity < graph.edgeCount / 2)
+    {
+      s->links = GrowColumn(s->links, 2 * sizeof(*s->links), graph.edgeCount / 2);
+      s->linkEdge = GrowColumn(s->linkEdge, sizeof(*s->linkEdge), graph.edgeCount / 2);
+      s->linkDensity = GrowColumn(s->linkDensity, sizeof(*s->linkDensity), graph.edgeCount / 2);
+      s->linkUtilization = GrowColumn(s->linkUtilization, sizeof(*s->linkUtilization), graph.edgeCount / 2);
+      s->linkSaturation = GrowColumn(s->linkSaturation, sizeof(*s->linkSaturation), graph.edgeCount / 2);
+      s->linkCapacity = graph.edgeCount / 2;
+    }
+    s->linkCount = 0;
+    for (int e = 0; e < graph.edgeCount; e += 2)
+    {
+      if (!graph.edgeAlive[e])
+        continue;
+      s->links[2 * s->linkCount] = graph.edgeFrom[e];
+      s->links[2 * s->linkCount + 1] = graph.edgeTo[e];
+      s->linkEdge[s->linkCount] = e;
+      s->linkCount++;
+    }
+    s->topologyVersion = graph.version;
+  }
+  for (int i = 0; i < nodeCount; i++)
+  {
+    s->originQueue[i] = QueuedAtNode(i, QUEUE_ORIGIN) + QueuedAtNode(i, QUEUE_INTERMEDIATE);
+    s->ackQueue[i] = QueuedAtNode(i, QUEUE_ACK);
+  }
+  for (int i = 0; i < s->linkCount; i++)
+  {
+    const EdgeState *ab = &edgeState[s->linkEdge[i]], *ba = &edgeState[s->linkEdge[i] ^ 1];
+    s->linkDensity[i] = (float)(ab->load + ba->load) / (ab->capacity + ba->capacity);
+  }
+  if (s->linkSampleSerial != linkSampleSerial || s->topologyVersion != s->linkSampleVersion)
+  {
+    for (int i = 0; i < s->linkCount; i++)
+    {
+      LinkSample ab = {0}, ba = {0};
+      if (linkSampleCount > 0)
+      {
+        ab = LinkSampleAt(s->linkEdge[i], 0);
+        ba = LinkSampleAt(s->linkEdge[i] ^ 1, 0);
+      }
+      s->linkUtilization[i] = fmaxf(ab.busy, ba.busy);
+      s->linkSaturation[i] = fmaxf(ab.saturated, ba.saturated);
+    }
+    s->linkSampleSerial = linkSampleSerial;
+    s->linkSampleVersion = s->topologyVersion;
+  }
+
+  s->messageLod = activeCount > MESSAGE_LOD_THRESHOLD;
+  if (!s->messageLod && s->messageCapacity < activeCount)
+  {
+    s->messagePos = GrowColumn(s->messagePos, sizeof(*s->messagePos), activeCount);
+    s->messageAck = GrowColumn(s->messageAck, sizeof(*s->messageAck), activeCount);
+    s->messageCapacity = activeCount;
+  }
+  s->messageCount = 0;
+  for (int k = 0; k < activeCount && !s->messageLod; k++)
+  {
+    int id = activeMessages[k];
+    if (msgs.state[id] == QUEUED)
+      continue;
+    int edge = msgs.segmentEdge[id];
+    Node *a = &nodes[graph.edgeFrom[edge]], *b = &nodes[graph.edgeTo[edge]];
+    float progress = MessageProgress(id);
+    s->messagePos[s->messageCount] = (Vector2){a->x + (b->x - a->x) * progress, a->y + (b->y - a->y) * progress};
+    s->messageAck[s->messageCount] = msgs.state[id] == ACK_RECEIVING;
+    s->messageCount++;
+  }
+  s->stats = ComputeStatistics();
+}
+
+// Monta o snapshot no buffer de trás e o troca pelo buffer pronto.
+void PublishSnapshot(void)
+{
+  BuildSnapshot(&snapshots[snapshotBack]);
+  int previous = atomic_exchange_explicit(&snapshotReady, snapshotBack | SNAPSHOT_FRESH, memory_order_acq_rel);
+  snapshotBack = previous & ~SNAPSHOT_FRESH;
+}
+
+// Snapshot mais recente para a thread de desenho; válido até a próxima chamada.
+const Snapshot *AcquireSnapshot(void)
+{
+  if (atomic_load_explicit(&snapshotReady, memory_order_relaxed) & SNAPSHOT_FRESH)
+  {
+    int previous = atomic_exchange_explicit(&snapshotReady, snapshotFront, memory_order_acq_rel);
+    snapshotFront = previous & ~SNAPSHOT_FRESH;
+  }
+  return &snapshots[snapshotFront];
+}
+
+static void *SimulationMain(void *arg)
+{
+  (void)arg;
+  Workload workload = CreateWorkload();
+  double last = WallSeconds();
+  while (!atomic_load(&simulationQuit))
+  {
+    ApplyCommands(&workload);
+    double now = WallSeconds();
+    float dt = (float)(now - last);
+    last = now;
+    UpdateWorkload(&workload, dt);
+    UpdateAsyncMessages(dt, 0.1f);
+    PublishSnapshot();
+
+    // Dorme até o próximo passo; PostCommand acorda antes
+    double wakeAt = now + SIM_STEP_SECONDS;
+    struct timespec deadline = {(time_t)wakeAt, (long)((wakeAt - (time_t)wakeAt) * 1e9)};
+    pthread_mutex_lock(&simulationWakeMutex);
+    if (atomic_load_explicit(&commandQueue.head, memory_order_relaxed) == atomic_load_explicit(&commandQueue.tail, memory_order_relaxed) &&
+        !atomic_load(&simulationQuit))
+      pthread_cond_timedwait(&simulationWake, &simulationWakeMutex, &deadline);
+    pthread_mutex_unlock(&simulationWakeMutex);
+  }
+  return NULL;
+}
+
+void StartSimulationThread(void)
+{
+  PublishSnapshot();
+  if (pthread_create(&simulationThread, NULL, SimulationMain, NULL) != 0)
+  {
+    fprintf(stderr, "Falha ao criar a thread de simulacao\n");
+    exit(1);
+  }
+}
+
+void StopSimulationThread(void)
+{
+  atomic_store(&simulationQuit, true);
+  WakeSimulation();
+  pthread_join(simulationThread, NULL);
+}
+
+//====================================================================================
+// ÍNDICE ESPACIAL E CÂMERA (thread de desenho)
+//====================================================================================
+// Grade uniforme sobre as coordenadas do mundo. Cada célula lista, em CSR, os
+// itens cujo retângulo envolvente a toca, e uma consulta só visita as células
+// que cruzam a área pedida. A janela indexa nós e ligações do snapshot para
+// escolher nós com o mouse e descartar o que está fora da câmera.
+
+#define GRID_MIN_CELL 64.0f // Lado mínimo de uma célula, em unidades do mundo
+#define CULL_MARGIN 80.0f   // Folga da área visível para rótulos e filas ao lado dos nós
+#define MIN_ZOOM 0.05f
+#define MAX_ZOOM 8.0f
+
+typedef struct SpatialGrid
+{
+  float originX, originY, cellSize;
+  int cols, rows;
+  int *cellStart; // cols * rows + 1 posições em 'items'
+  int cellCapacity;
+  int *items;
+  int itemCapacity;
+  unsigned int *seen; // Por item: última consulta que já o devolveu
+  int itemCount, seenCapacity;
+  unsigned int query;
+  int *hits; // Candidatos da última consulta, sem repetição
+  int hitCount, hitCapacity;
+} SpatialGrid;
+
+SpatialGrid nodeGrid, linkGrid;
+unsigned int spatialIndexVersion = 0; // graph.version indexado (0 = nenhum)
+
+// Células tocadas por 'area'; false se ela está toda fora da grade.
+static bool GridCellRange(const SpatialGrid *g, Rectangle area, int *c0, int *r0, int *c1, int *r1)
+{
+  if (g->cols == 0)
+    return false;
+  *c0 = (int)floorf((area.x - g->originX) / g->cellSize);
+  *r0 = (int)floorf((area.y - g->originY) / g->cellSize);
+  *c1 = (int)floorf((area.x + area.width - g->originX) / g->cellSize);
+  *r1 = (int)floorf((area.y + area.height - g->originY) / g->cellSize);
+  if (*c1 < 0 || *r1 < 0 || *c0 >= g->cols || *r0 >= g->rows)
+    return false;
+  *c0 = *c0 < 0 ? 0 : *c0;
+  *r0 = *r0 < 0 ? 0 : *r0;
+  *c1 = *c1 >= g->cols ? g->cols - 1 : *c1;
+  *r1 = *r1 >= g->rows ? g->rows - 1 : *r1;
+  return true;
+}
+
+void BuildSpatialGrid(SpatialGrid *g, const Rectangle *bounds, int count)
+{
+  g->cols = g->rows = 0;
+  g->itemCount = count;
+  if (count == 0)
+    return;
+  float minX = bounds[0].x, minY = bounds[0].y;
+  float maxX = bounds[0].x + bounds[0].width, maxY = bounds[0].y + bounds[0].height;
+  for (int i = 1; i < count; i++)
+  {
+    minX = fminf(minX, bounds[i].x);
+    minY = fminf(minY, bounds[i].y);
+    maxX = fmaxf(maxX, bounds[i].x + bounds[i].width);
+    maxY = fmaxf(maxY, bounds[i].y + bounds[i].height);
+  }
+  // Cerca de um item por célula, sem deixar uma faixa estreita virar milhões de células
+  float width = maxX - minX, height = maxY - minY;
+  g->cellSize = fmaxf(GRID_MIN_CELL, fmaxf(sqrtf(width * height / count), fmaxf(width, height) / count));
+  g->originX = minX;
+  g->originY = minY;
+  g->cols = (int)(width / g->cellSize) + 1;
+  g->rows = (int)(height / g->cellSize) + 1;
+
+  int cells = g->cols * g->rows;
+  if (g->cellCapacity < cells + 1)
+  {
+    g->cellStart = GrowColumn(g->cellStart, sizeof(*g->cellStart), cells + 1);
+    g->cellCapacity = cells + 1;
+  }
+  memset(g->cellStart, 0, (cells + 1) * sizeof(*g->cellStart));
+  int c0, r0, c1, r1;
+  for (int i = 0; i < count; i++)
+  {
+    GridCellRange(g, bounds[i], &c0, &r0, &c1, &r1);
+    for (int r = r0; r <= r1; r++)
+      for (int c = c0; c <= c1; c++)
+        g->cellStart[r * g->cols + c + 1]++;
+  }
+  for (int cell = 0; cell < cells; cell++)
+    g->cellStart[cell + 1] += g->cellStart[cell];
+
+  if (g->itemCapacity < g->cellStart[cells])
+  {
+    g->items = GrowColumn(g->items, sizeof(*g->items), g->cellStart[cells]);
+    g->itemCapacity = g->cellStart[cells];
+  }
+  // Preenche avançando o início de cada célula e depois o devolve ao lugar
+  for (int i = 0; i < count; i++)
+  {
+    GridCellRange(g, bounds[i], &c0, &r0, &c1, &r1);
+    for (int r = r0; r <= r1; r++)
+      for (int c = c0; c <= c1; c++)
+        g->items[g->cellStart[r * g->cols + c]++] = i;
+  }
+  for (int cell = cells; cell > 0; cell--)
+    g->cellStart[cell] = g->cellStart[cell - 1];
+  g->cellStart[0] = 0;
+
+  if (g->seenCapacity < count)
+  {
+    g->seen = GrowColumn(g->seen, sizeof(*g->seen), count);
+    g->seenCapacity = count;
+  }
+  memset(g->seen, 0, count * sizeof(*g->seen));
+  g->query = 0;
+}
+
+// Preenche g->hits com os itens cujo retângulo pode cruzar 'area' e retorna quantos são.
+int QuerySpatialGrid(SpatialGrid *g, Rectangle area)
+{
+  g->hitCount = 0;
+  int c0, r0, c1, r1;
+  if (!GridCellRange(g, area, &c0, &r0, &c1, &r1))
+    return 0;
+  if (++g->query == 0)
+  {
+    memset(g->seen, 0, g->itemCount * sizeof(*g->seen));
+    g->query = 1;
+  }
+  for (int r = r0; r <= r1; r++)
+    for (int c = c0; c <= c1; c++)
+    {
+      int cell = r * g->cols + c;
+      for (int k = g->cellStart[cell]; k < g->cellStart[cell + 1]; k++)
+      {
+        int item = g->items[k];
+        if (g->seen[item] == g->query)
+          continue;
+        g->seen[item] = g->query;
+        if (g->hitCount == g->hitCapacity)
+        {
+          g->hitCapacity = g->hitCapacity ? 2 * g->hitCapacity : 256;
+          g->hits = GrowColumn(g->hits, sizeof(*g->hits), g->hitCapacity);
+        }
+        g->hits[g->hitCount++] = item;
+      }
+    }
+  return g->hitCount;
+}
+
+// Reindexa nós e ligações quando a topologia do snapshot muda.
+void UpdateSpatialIndex(const Snapshot *view)
+{
+  static Rectangle *bounds = NULL;
+  static int boundsCapacity = 0;
+  if (spatialIndexVersion == view->topologyVersion)
+    return;
+  int needed = view->nodeCount > view->linkCount ? view->nodeCount : view->linkCount;
+  if (boundsCapacity < needed)
+  {
+    bounds = GrowColumn(bounds, sizeof(*bounds), needed);
+    boundsCapacity = needed;
+  }
+  for (int i = 0; i < view->nodeCount; i++)
+    bounds[i] = (Rectangle){view->nodes[i].x - NODE_RADIUS, view->nodes[i].y - NODE_RADIUS, 2 * NODE_RADIUS, 2 * NODE_RADIUS};
+  BuildSpatialGrid(&nodeGrid, bounds, view->nodeCount);
+  for (int i = 0; i < view->linkCount; i++)
+  {
+    const Node *a = &view->nodes[view->links[2 * i]], *b = &view->nodes[view->links[2 * i + 1]];
+    bounds[i] = (Rectangle){fminf(a->x, b->x), fminf(a->y, b->y), fabsf(a->x - b->x), fabsf(a->y - b->y)};
+  }
+  BuildSpatialGrid(&linkGrid, bounds, view->linkCount);
+  spatialIndexVersion = view->topologyVersion;
+}
+
+// Nó de menor id sob o ponto 'world', ou -1.
+int PickNode(const Snapshot *view, Vector2 world)
+{
+  int picked = -1;
+  QuerySpatialGrid(&nodeGrid, (Rectangle){world.x, world.y, 0, 0});
+  for (int k = 0; k < nodeGrid.hitCount; k++)
+  {
+    int i = nodeGrid.hits[k];
+    if ((picked == -1 || i < picked) && CheckCollisionPointCircle(world, (Vector2){view->nodes[i].x, view->nodes[i].y}, NODE_RADIUS))
+      picked = i;
+  }
+  return picked;
+}
+
+// Roda do mouse aproxima em torno do cursor, botão do meio arrasta e R volta à vista inicial.
+void UpdateViewCamera(Camera2D *camera, Vector2 mouse)
+{
+  float wheel = GetMouseWheelMove();
+  if (wheel != 0.0f)
+  {
+    camera->target = GetScreenToWorld2D(mouse, *camera);
+    camera->offset = mouse;
+    camera->zoom = fminf(MAX_ZOOM, fmaxf(MIN_ZOOM, camera->zoom * expf(0.1f * wheel)));
+  }
+  if (IsMouseButtonDown(MOUSE_BUTTON_MIDDLE))
+  {
+    Vector2 delta = GetMouseDelta();
+    camera->target.x -= delta.x / camera->zoom;
+    camera->target.y -= delta.y / camera->zoom;
+  }
+  if (IsKeyPressed(KEY_R))
+    *camera = (Camera2D){.zoom = 1.0f};
+}
+
+// Área do mundo vista pela câmera numa tela width x height, com CULL_MARGIN de folga.
+Rectangle VisibleWorldRect(Camera2D camera, int width, int height)
+{
+  Vector2 a = GetScreenToWorld2D((Vector2){0, 0}, camera);
+  Vector2 b = GetScreenToWorld2D((Vector2){(float)width, (float)height}, camera);
+  return (Rectangle){a.x - CULL_MARGIN, a.y - CULL_MARGIN, b.x - a.x + 2 * CULL_MARGIN, b.y - a.y + 2 * CULL_MARGIN};
+}
+
+//====================================================================================
+// FUNÇÕES DE VISUALIZAÇÃO E MAIN
+//====================================================================================
+
+void PrintNonCompletedMessages()
+{
+  printf("\n---[ Status das Mensagens Nao Concluidas ]---\n");
+  for (int k = 0; k < activeCount; k++)
+  {
+    int i = activeMessages[k];
+    const char *stateStr;
+    switch (msgs.state[i])
+    {
+    case SENDING:
+      stateStr = "ENVIANDO";
+      break;
+    case ACK_RECEIVING:
+      stateStr = "RECEBENDO ACK";
+      break;
+    case QUEUED:
+      stateStr = "ENFILEIRADA";
+      break;
+    default:
+      stateStr = "DESCONHECIDO";
+      break;
+    }
+    printf("Msg[%d]: De %d->%d | Estado: %-15s", i, msgs.from[i], msgs.to[i], stateStr);
+    if (msgs.state[i] == QUEUED)
+    {
+      printf("| Local: No %d\n", msgs.queuedAtNodeId[i]);
+    }
+    else if (msgs.state[i] == SENDING)
+    {
+      printf("| Progresso: %.2f | Segmento: %d de %d\n", MessageProgress(i), msgs.currentSegment[i], RouteLength(msgs.route[i]) - 1);
+    }
+    else if (msgs.state[i] == ACK_RECEIVING)
+    {
+      printf("| Progresso: %.2f | Segmento ACK: %d de %d\n", MessageProgress(i), msgs.currentAckSegment[i], RouteLength(msgs.ackRoute[i]) - 1);
+    }
+  }
+  if (activeCount == 0)
+    printf("Todas as mensagens foram concluidas com sucesso.\n");
+  else
+    printf("Total de mensagens nao concluidas: %d\n", activeCount);
+  printf("---[ Fim do Relatorio ]---\n\n");
+}
+
+// Ligações, nós e rótulos ficam pré-desenhados numa textura do tamanho da tela,
+// refeita só quando graph.version ou a câmera mudam (e, colorindo por uso, a
+// cada nova amostra das arestas); o quadro desenha apenas um quad.
+RenderTexture2D topologyLayer;
+unsigned int topologyLayerVersion = 0; // graph.version desenhado na textura (0 = nenhum)
+Camera2D topologyLayerCamera;
+bool colorByUtilization = false;     // Tecla U: ligações coloridas pela última amostra de uso
+bool topologyLayerUtilization = false;
+unsigned int topologyLayerSample = 0;
+
+void LoadTopologyLayer(int width, int height)
+{
+  topologyLayer = LoadRenderTexture(width, height);
+  topologyLayerVersion = 0;
+}
+
+void UnloadTopologyLayer(void)
+{
+  UnloadRenderTexture(topologyLayer);
+}
+
+static bool SameCamera(Camera2D a, Camera2D b)
+{
+  return a.offset.x == b.offset.x && a.offset.y == b.offset.y && a.target.x == b.target.x &&
+         a.target.y == b.target.y && a.rotation == b.rotation && a.zoom == b.zoom;
+}
+
+// Redesenha a camada se a topologia do snapshot ou a câmera mudaram, só com o
+// que cai em 'visible'. Deve ser chamada fora de BeginDrawing.
+void UpdateTopologyLayer(const Snapshot *view, Camera2D camera, Rectangle visible)
+{
+  if (topologyLayerVersion == view->topologyVersion && SameCamera(camera, topologyLayerCamera) &&
+      topologyLayerUtilization == colorByUtilization && (!colorByUtilization || topologyLayerSample == view->linkSampleSerial))
+    return;
+  BeginTextureMode(topologyLayer);
+  ClearBackground(RAYWHITE);
+  BeginMode2D(camera);
+  QuerySpatialGrid(&linkGrid, visible);
+  for (int k = 0; k < linkGrid.hitCount; k++)
+  {
+    int i = linkGrid.hits[k];
+    const Node *a = &view->nodes[view->links[2 * i]], *b = &view->nodes[view->links[2 * i + 1]];
+    if (colorByUtilization)
+    {
+      // Cor pela fração ocupada, espessura pela fração saturada
+      Color color = ColorLerp(LIGHTGRAY, RED, view->linkUtilization[i]);
+      DrawLineEx((Vector2){a->x, a->y}, (Vector2){b->x, b->y}, 2.0f + 8.0f * view->linkSaturation[i], color);
+    }
+    else
+      DrawLine(a->x, a->y, b->x, b->y, GRAY);
+  }
+  QuerySpatialGrid(&nodeGrid, visible);
+  for (int k = 0; k < nodeGrid.hitCount; k++)
+  {
+    const Node *node = &view->nodes[nodeGrid.hits[k]];
+    DrawCircle(node->x, node->y, NODE_RADIUS, BLUE);
+    char label[12];
+    sprintf(label, "%d", node->id);
+    DrawText(label, node->x - 5, node->y - 10, 20, WHITE);
+  }
+  EndMode2D();
+  EndTextureMode();
+  topologyLayerVersion = view->topologyVersion;
+  topologyLayerCamera = camera;
+  topologyLayerUtilization = colorByUtilization;
+  topologyLayerSample = view->linkSampleSerial;
+}
+
+// A camada já foi recortada pela área visível em UpdateTopologyLayer; aqui só
+// vai o quad da textura, na tela e fora de BeginMode2D.
+void DrawNetwork(void)
+{
+  // Texturas de renderização ficam invertidas no eixo y
+  Rectangle source = {0, 0, (float)topologyLayer.texture.width, -(float)topologyLayer.texture.height};
+  DrawTextureRec(topologyLayer.texture, source, (Vector2){0, 0}, WHITE);
+}
+
+// Círculo branco com contorno preto, desenhado uma vez e reaproveitado como
+// sprite: cada mensagem vira um quad com a mesma textura, e o raylib junta
+// todos num único lote de vértices em vez de dois círculos por mensagem.
+RenderTexture2D messageSprite;
+
+void LoadMessageSprite(void)
+{
+  int size = 2 * MESSAGE_RADIUS + 2;
+  messageSprite = LoadRenderTexture(size, size);
+  BeginTextureMode(messageSprite);
+  ClearBackground(BLANK);
+  DrawCircle(size / 2, size / 2, MESSAGE_RADIUS, WHITE);
+  DrawCircleLines(size / 2, size / 2, MESSAGE_RADIUS, BLACK);
+  EndTextureMode();
+}
+
+void UnloadMessageSprite(void)
+{
+  UnloadRenderTexture(messageSprite);
+}
+
+void DrawMessageMarker(Vector2 pos, Color color)
+{
+  float half = messageSprite.texture.width / 2.0f;
+  DrawTextureV(messageSprite.texture, (Vector2){pos.x - half, pos.y - half}, color);
+}
+
+// Desenha em coordenadas do mundo, dentro de BeginMode2D.
+void DrawTravelingMessages(const Snapshot *view, Rectangle visible)
+{
+  if (view->messageLod)
+  {
+    // Barra de calor por ligação no lugar das mensagens individuais
+    QuerySpatialGrid(&linkGrid, visible);
+    for (int k = 0; k < linkGrid.hitCount; k++)
+    {
+      int i = linkGrid.hits[k];
+      float density = view->linkDensity[i];
+      if (density <= 0.0f)
+        continue;
+      const Node *a = &view->nodes[view->links[2 * i]], *b = &view->nodes[view->links[2 * i + 1]];
+      Color color = ColorLerp(YELLOW, RED, density);
+      DrawLineEx((Vector2){a->x, a->y}, (Vector2){b->x, b->y}, 2.0f + 8.0f * density, color);
+    }
+    return;
+  }
+  for (int k = 0; k < view->messageCount; k++)
+    if (CheckCollisionPointRec(view->messagePos[k], visible))
+      DrawMessageMarker(view->messagePos[k], view->messageAck[k] ? GREEN : RED);
+}
+
+// Desenha em coordenadas do mundo, dentro de BeginMode2D.
+void DrawQueuedMessages(const Snapshot *view, Rectangle visible)
+{
+  QuerySpatialGrid(&nodeGrid, visible);
+  for (int k = 0; k < nodeGrid.hitCount; k++)
+  {
+    int nodeId = nodeGrid.hits[k];
+    const Node *node = &view->nodes[nodeId];
+    bool hasOriginQueue = view->originQueue[nodeId] > 0;
+    bool hasAckQueue = view->ackQueue[nodeId] > 0;
+    if (hasOriginQueue)
+    {
+      Vector2 pos = {node->x + QUEUE_OFFSET_X + 10, node->y - (NODE_RADIUS / 2.0f)};
+      DrawMessageMarker(pos, RED);
+      char countText[16];
+      sprintf(countText, "%d", view->originQueue[nodeId]);
+      DrawText(countText, pos.x + 12, pos.y - 8, 20, BLACK);
+    }
+    if (hasAckQueue)
+    {
+      Vector2 pos = {node->x + QUEUE_OFFSET_X + 10, node->y + (NODE_RADIUS / 2.0f)};
+      DrawMessageMarker(pos, GREEN);
+      char countText[16];
+      sprintf(countText, "%d", view->ackQueue[nodeId]);
+      DrawText(countText, pos.x + 12, pos.y - 8, 20, BLACK);
+    }
+  }
+}
+
+void DrawUI(Rectangle uiArea, int *uiFromNode, int *uiToNode, int *uiMsgCount, bool *sendPressed)
+{
+  static char fromText[8] = "0";
+  static char toText[8] = "13";
+  static char msgText[8] = "50";
+  static int activeBox = -1;
+  DrawRectangleRec(uiArea, (Color){200, 200, 200, 180});
+  DrawRectangleLinesEx(uiArea, 2, DARKGRAY);
+  int startX = uiArea.x + 10;
+  int startY = uiArea.y + 10;
+  int boxW = 60, boxH = 30, spacing = 40;
+  DrawText("Origem:", startX, startY, 20, DARKGRAY);
+  DrawText("Destino:", startX, startY + spacing, 20, DARKGRAY);
+  DrawText("Qtd:", startX, startY + 2 * spacing, 20, DARKGRAY);
+  Rectangle boxFrom = {startX + 100, startY, boxW, boxH};
+  Rectangle boxTo = {startX + 100, startY + spacing, boxW, boxH};
+  Rectangle boxMsg = {startX + 100, startY + 2 * spacing, boxW, boxH};
+  if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
+  {
+    if (CheckCollisionPointRec(GetMousePosition(), boxFrom))
+      activeBox = 0;
+    else if (CheckCollisionPointRec(GetMousePosition(), boxTo))
+      activeBox = 1;
+    else if (CheckCollisionPointRec(GetMousePosition(), boxMsg))
+      activeBox = 2;
+    else if (!CheckCollisionPointRec(GetMousePosition(), uiArea))
+      activeBox = -1;
+  }
+  if (activeBox != -1)
+  {
+    char *target = NULL;
+    if (activeBox == 0)
+      target = fromText;
+    if (activeBox == 1)
+      target = toText;
+    if (activeBox == 2)
+      target = msgText;
+    SetMouseCursor(MOUSE_CURSOR_IBEAM);
+    int key = GetCharPressed();
+    while (key > 0)
+    {
+      if (key >= '0' && key <= '9' && (strlen(target) < 7))
+      {
+        int len = strlen(target);
+        target[len] = (char)key;
+        target[len + 1] = '\0';
+      }
+      key = GetCharPressed();
+    }
+    if (IsKeyPressed(KEY_BACKSPACE))
+    {
+      int len = strlen(target);
+      if (len > 0)
+        target[len - 1] = '\0';
+    }
+  }
+  else
+  {
+    SetMouseCursor(MOUSE_CURSOR_DEFAULT);
+  }
+  DrawRectangleLinesEx(boxFrom, 2, (activeBox == 0) ? RED : DARKGRAY);
+  DrawText(fromText, boxFrom.x + 5, boxFrom.y + 5, 20, BLACK);
+  DrawRectangleLinesEx(boxTo, 2, (activeBox == 1) ? RED : DARKGRAY);
+  DrawText(toText, boxTo.x + 5, boxTo.y + 5, 20, BLACK);
+  DrawRectangleLinesEx(boxMsg, 2, (activeBox == 2) ? RED : DARKGRAY);
+  DrawText(msgText, boxMsg.x + 5, boxMsg.y + 5, 20, BLACK);
+  Rectangle btn = {startX, startY + 3 * spacing, boxW + 100, boxH};
+  DrawRectangleRec(btn, LIGHTGRAY);
+  DrawRectangleLinesEx(btn, 2, DARKGRAY);
+  DrawText("Enviar", btn.x + 10, btn.y + 5, 20, BLACK);
+  if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && CheckCollisionPointRec(GetMousePosition(), btn))
+  {
+    *uiFromNode = atoi(fromText);
+    *uiToNode = atoi(toText);
+    *uiMsgCount = atoi(msgText);
+    *sendPressed = true;
+  }
+}
+
+// ALTERADO: Função de estatísticas agora inclui o cálculo e a exibição da VAZÃO (Throughput).
+void DrawStatistics(int screenW, const Snapshot *view)
+{
+  // Aumenta a altura da área para caber a nova estatística
+  Rectangle statsArea = {screenW - 270, 200, 260, 270};
+  DrawRectangleRec(statsArea, (Color){220, 220, 220, 190});
+  DrawRectangleLinesEx(statsArea, 2, DARKGRAY);
+
+  DrawText("--- Estatisticas ---", statsArea.x + 10, statsArea.y + 10, 20, BLACK);
+
+  // Latência média e vazão calculadas sobre o relógio da simulação
+  Statistics st = view->stats;
+
+  // Exibe as estatísticas
+  DrawText(TextFormat("Msgs Concluidas: %d", st.completed), statsArea.x + 10, statsArea.y + 40, 20, DARKGRAY);
+  DrawText(TextFormat("Latencia: %.2f ms", st.avgLatencyMs), statsArea.x + 10, statsArea.y + 70, 20, DARKGRAY);
+  DrawText(TextFormat("Timeouts: %d", st.timeouts), statsArea.x + 10, statsArea.y + 100, 20, DARKGRAY);
+
+  // --- NOVO: EXIBIÇÃO DA VAZÃO ---
+  DrawText(TextFormat("Vazao: %.2f msg/s", st.throughput), statsArea.x + 10, statsArea.y + 130, 20, DARKGRAY);
+  DrawText(TextFormat("Filas O/A/I: %d/%d/%d", st.queued[QUEUE_ORIGIN], st.queued[QUEUE_ACK], st.queued[QUEUE_INTERMEDIATE]),
+           statsArea.x + 10, statsArea.y + 160, 20, DARKGRAY);
+  DrawText(TextFormat("p50/90/99: %.0f/%.0f/%.0f ms", st.p50Ms, st.p90Ms, st.p99Ms), statsArea.x + 10, statsArea.y + 190, 20, DARKGRAY);
+  DrawText(TextFormat("p99.9/max: %.0f/%.0f ms", st.p999Ms, st.maxLatencyMs), statsArea.x + 10, statsArea.y + 220, 20, DARKGRAY);
+}
+
+//====================================================================================
+// BENCHMARKS (--bench, sem janela)
+//====================================================================================
+// Mede os caminhos quentes do motor e a preparação do desenho. Cada medida
+// imprime uma linha JSON em stdout, para comparar a saída antes e depois de
+// qualquer mudança de desempenho:
+//   {"bench":"...","ops":N,"ns_per_op":X,"msgs_per_sec":Y,"peak_rss_kb":Z}
+// msgs_per_sec é null quando a medida não processa mensagens e peak_rss_kb é
+// null onde o sistema não informa o pico de memória.
+
+#define BENCH_MIN_SECONDS 0.2 // Medidas repetidas rodam por pelo menos esse tempo real
+
+const char *benchFilter = NULL; // Só roda as medidas cujo nome contém esse texto
+
+// Pico de memória residente do processo em KiB, ou -1 se indisponível.
+long PeakRssKb(void)
+{
+#ifdef _WIN32
+  return -1; // GetProcessMemoryInfo exige windows.h, que conflita com raylib.h
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return -1;
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024; // Em bytes no macOS
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static bool BenchSelected(const char *name)
+{
+  return benchFilter == NULL || strstr(name, benchFilter) != NULL;
+}
+
+// 'messages' < 0 quando a medida não processa mensagens.
+static void ReportBench(const char *name, long long ops, double seconds, double messages)
+{
+  long rss = PeakRssKb();
+  printf("{\"bench\":\"%s\",\"ops\":%lld,\"ns_per_op\":%.1f,", name, ops, seconds * 1e9 / ops);
+  if (messages >= 0.0)
+    printf("\"msgs_per_sec\":%.0f,", messages / seconds);
+  else
+    printf("\"msgs_per_sec\":null,");
+  if (rss >= 0)
+    printf("\"peak_rss_kb\":%ld}\n", rss);
+  else
+    printf("\"peak_rss_kb\":null}\n");
+  fflush(stdout);
+}
+
+static void SetAllLinkCapacity(int capacity)
+{
+  for (int e = 0; e < graph.edgeCount; e++)
+    edgeState[e].capacity = capacity;
+}
+
+static int RandomOtherNode(int node)
+{
+  return (node + 1 + rand() % (nodeCount - 1)) % nodeCount;
+}
+
+static void FreeSnapshot(Snapshot *s)
+{
+  free(s->nodes);
+  free(s->links);
+  free(s->linkEdge);
+  free(s->linkDensity);
+  free(s->linkUtilization);
+  free(s->linkSaturation);
+  free(s->messagePos);
+  free(s->messageAck);
+  free(s->originQueue);
+  free(s->ackQueue);
+  *s = (Snapshot){0};
+}
+
+// BuildPath entre pares aleatórios numa grade cols x rows. Grades com o mesmo
+// número de nós e formatos diferentes separam o efeito do diâmetro. "cold"
+// invalida o cache antes de cada busca; "cached" repete 64 pares fixos.
+static void BenchBuildPath(int cols, int rows, bool cold)
+{
+  char name[64];
+  sprintf(name, "BuildPath/grid%dx%d/%s", cols, rows, cold ? "cold" : "cached");
+  if (!BenchSelected(name))
+    return;
+  CreateGridNetwork(cols, rows);
+  int *path = GrowColumn(NULL, sizeof(*path), nodeCount);
+  int pairs[64][2];
+  for (int k = 0; k < 64; k++)
+  {
+    pairs[k][0] = rand() % nodeCount;
+    pairs[k][1] = RandomOtherNode(pairs[k][0]);
+  }
+  long long ops = 0;
+  double start = WallSeconds();
+  do
+  {
+    for (int k = 0; k < 64; k++)
+    {
+      int a = pairs[k][0], b = pairs[k][1];
+      if (cold)
+      {
+        routeEpoch++; // Invalida as rotas guardadas
+        a = rand() % nodeCount;
+        b = RandomOtherNode(a);
+      }
+      BuildPath(a, b, path, nodeCount);
+      ops++;
+    }
+  } while (WallSeconds() - start < BENCH_MIN_SECONDS);
+  ReportBench(name, ops, WallSeconds() - start, -1.0);
+  free(path);
+}
+
+// AddAsyncMessage com enlaces sempre livres (toda mensagem parte na hora) ou
+// sem capacidade (toda mensagem entra na fila da origem).
+static void BenchAddMessage(bool saturated)
+{
+  const char *name = saturated ? "AddAsyncMessage/grid32x32/saturated" : "AddAsyncMessage/grid32x32/empty";
+  if (!BenchSelected(name))
+    return;
+  const int count = 100000;
+  CreateGridNetwork(32, 32);
+  SetAllLinkCapacity(saturated ? 0 : MAX_MESSAGES);
+  double start = WallSeconds();
+  for (int i = 0; i < count; i++)
+  {
+    int from = rand() % nodeCount;
+    AddAsyncMessage(from, RandomOtherNode(from));
+  }
+  ReportBench(name, count, WallSeconds() - start, count);
+}
+
+// Um segundo simulado de UpdateAsyncMessages (60 passos) com 'active'
+// mensagens em andamento, seguido da preparação do desenho no mesmo estado.
+// msgs_per_sec conta mensagens ativas atualizadas por segundo real.
+static void BenchUpdate(int active)
+{
+  char name[64], snapshotName[64];
+  sprintf(name, "UpdateAsyncMessages/grid16x16/%d", active);
+  sprintf(snapshotName, "BuildSnapshot/grid16x16/%d", active);
+  if (!BenchSelected(name) && !BenchSelected(snapshotName))
+    return;
+  CreateGridNetwork(16, 16);
+  SetAllLinkCapacity(MAX_MESSAGES);
+  for (int i = 0; i < active; i++)
+  {
+    int from = rand() % nodeCount;
+    AddAsyncMessage(from, RandomOtherNode(from));
+  }
+
+  if (BenchSelected(name))
+  {
+    const int steps = 60;
+    double updates = 0.0;
+    double start = WallSeconds();
+    for (int i = 0; i < steps; i++)
+    {
+      updates += activeCount;
+      UpdateAsyncMessages(1.0f / 60.0f, 0.1f);
+    }
+    ReportBench(name, steps, WallSeconds() - start, updates);
+  }
+
+  if (BenchSelected(snapshotName))
+  {
+    Snapshot snapshot = {0};
+    BuildSnapshot(&snapshot); // A cópia da topologia só acontece quando ela muda
+    long long ops = 0;
+    double start = WallSeconds();
+    do
+    {
+      BuildSnapshot(&snapshot);
+      ops++;
+    } while (WallSeconds() - start < BENCH_MIN_SECONDS);
+    // Acima de MESSAGE_LOD_THRESHOLD as posições não são copiadas: não há mensagens por operação
+    ReportBench(snapshotName, ops, WallSeconds() - start, snapshot.messageLod ? -1.0 : (double)ops * snapshot.messageCount);
+    FreeSnapshot(&snapshot);
+  }
+}
+
+// Geração de uma topologia com 'n' nós, do zero. msgs_per_sec conta nós gerados por segundo.
+static void BenchCreateTopology(const char *topology, int n)
+{
+  char name[64];
+  sprintf(name, "CreateTopology/%s/%d", topology, n);
+  if (!BenchSelected(name))
+    return;
+  double start = WallSeconds();
+  CreateTopology(topology, n, 4, 1);
+  double seconds = WallSeconds() - start;
+  ReportBench(name, 1, seconds, nodeCount);
+}
+
+// Carga de um toro com 'n' nós salvo no formato binário; o arquivo fica no
+// cache do sistema, então mede o mapeamento e a cópia, não o disco.
+static void BenchLoadTopology(int n)
+{
+  char name[64];
+  sprintf(name, "LoadTopologyFile/torus/%d", n);
+  if (!BenchSelected(name))
+    return;
+  const char *path = "bench-topology.bin";
+  CreateTopology("torus", n, 4, 1);
+  if (!SaveTopologyFile(path))
+    return;
+  long long ops = 0;
+  double start = WallSeconds();
+  do
+  {
+    LoadTopologyFile(path);
+    ops++;
+  } while (WallSeconds() - start < BENCH_MIN_SECONDS);
+  ReportBench(name, ops, WallSeconds() - start, -1.0);
+  remove(path);
+}
+
+// Reconstrução do índice espacial e consultas do tamanho da tela numa grade grande.
+static void BenchSpatialIndex(int side)
+{
+  char buildName[64], queryName[64];
+  sprintf(buildName, "UpdateSpatialIndex/grid%dx%d", side, side);
+  sprintf(queryName, "QuerySpatialGrid/grid%dx%d", side, side);
+  if (!BenchSelected(buildName) && !BenchSelected(queryName))
+    return;
+  CreateGridNetwork(side, side);
+  Snapshot snapshot = {0};
+  BuildSnapshot(&snapshot);
+
+  long long ops = 0;
+  double start = WallSeconds();
+  do
+  {
+    spatialIndexVersion = 0;
+    UpdateSpatialIndex(&snapshot);
+    ops++;
+  } while (WallSeconds() - start < BENCH_MIN_SECONDS);
+  if (BenchSelected(buildName))
+    ReportBench(buildName, ops, WallSeconds() - start, -1.0);
+
+  if (BenchSelected(queryName))
+  {
+    float extent = 60.0f + 80.0f * side;
+    ops = 0;
+    start = WallSeconds();
+    do
+    {
+      Rectangle area = {(float)(rand() % (int)extent), (float)(rand() % (int)extent), 1280, 720};
+      QuerySpatialGrid(&nodeGrid, area);
+      QuerySpatialGrid(&linkGrid, area);
+      ops++;
+    } while (WallSeconds() - start < BENCH_MIN_SECONDS);
+    ReportBench(queryName, ops, WallSeconds() - start, -1.0);
+  }
+  FreeSnapshot(&snapshot);
+}
+
+void PrintBenchUsage(void)
+{
+  fprintf(stderr,
+          "Uso: app --bench [opcoes]\n"
+          "  --filter TEXTO  roda so as medidas cujo nome contem TEXTO\n"
+          "  --quick         pula as medidas maiores (10^6 mensagens, grade 128x128, topologias com 10^6 nos)\n"
+          "  --threads N     threads do passo paralelo (padrao: 1)\n");
+}
+
+int RunBenchmarks(int argc, char **argv)
+{
+  bool quick = false;
+  int threads = 1;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--quick") == 0)
+      quick = true;
+    else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+      benchFilter = argv[++i];
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 1)
+      threads = atoi(argv[++i]);
+    else
+    {
+      PrintBenchUsage();
+      return 1;
+    }
+  }
+  logTimeouts = false;
+  srand(1);
+  StartWorkerPool(threads);
+
+  BenchBuildPath(8, 8, false);
+  BenchBuildPath(8, 8, true);
+  BenchBuildPath(32, 32, true);
+  BenchBuildPath(256, 4, true); // Mesmos 1024 nós de 32x32, diâmetro quatro vezes maior
+  if (!quick)
+    BenchBuildPath(128, 128, true);
+  BenchAddMessage(false);
+  BenchAddMessage(true);
+  BenchUpdate(1000);
+  BenchUpdate(100000);
+  if (!quick)
+    BenchUpdate(1000000);
+  BenchSpatialIndex(32);
+  if (!quick)
+    BenchSpatialIndex(128);
+  for (size_t i = 0; i < sizeof(topologyGenerators) / sizeof(topologyGenerators[0]); i++)
+    BenchCreateTopology(topologyGenerators[i].name, quick ? 100000 : 1000000);
+  BenchLoadTopology(quick ? 100000 : 1000000);
+  return 0;
+}
+
+//====================================================================================
+// MODO HEADLESS (sem janela, passo de tempo simulado fixo)
+//====================================================================================
+
+void PrintHeadlessUsage(void)
+{
+  fprintf(stderr,
+          "Uso: app --headless [opcoes]\n"
+          "  --topology NOME            default, grid, torus, geometric, erdos-renyi,\n"
+          "                             barabasi-albert, fat-tree ou ring-of-cliques (padrao: default)\n"
+          "  --nodes N                  nos das topologias geradas (padrao: 1024; fat-tree arredonda para cima)\n"
+          "  --degree D                 grau medio (geometric, erdos-renyi), 2x ligacoes por no novo\n"
+          "                             (barabasi-albert) ou tamanho da clique - 1 (padrao: 4)\n"
+          "  --topology-seed N          semente da topologia (padrao: a de --seed)\n"
+          "  --topology-file ARQUIVO    carrega a topologia de uma lista de arestas ou do formato binario\n"
+          "  --save-topology ARQUIVO    grava a topologia antes de simular (.txt: texto; outros: binario)\n"
+          "  --workload burst|stream    tipo de carga (padrao: burst)\n"
+          "  --from N --to N --count N  origem, destino e quantidade do fluxo (stream)\n"
+          "  --rounds N --burst-size N  rodadas e mensagens por rodada (burst)\n"
+          "  --interval S               intervalo entre envios em segundos simulados\n"
+          "  --duration S               tempo simulado maximo em segundos\n"
+          "  --dt S                     passo fixo da simulacao (padrao: 1/60)\n"
+          "  --release S                intervalo de liberacao das filas (padrao: 0.1)\n"
+          "  --capacity N               mensagens simultaneas por aresta (padrao: 20)\n"
+          "  --speed V                  segmentos percorridos por segundo (padrao: 1.5)\n"
+          "  --timeout S                prazo inicial e minimo de retransmissao em segundos (padrao: 60)\n"
+          "  --csv                      imprime so um cabecalho e uma linha CSV\n"
+          "  --seed N                   semente do gerador aleatorio\n"
+          "  --threads N                threads do passo paralelo (padrao: 1); divide as chegadas\n"
+          "                             de salto de cada fatia de tempo de um segmento, a partir de\n"
+          "                             64 chegadas por fatia; a ordem das vagas dentro da fatia\n"
+          "                             pode diferir de --threads 1\n"
+          "  --latency-breakdown        latencia por numero de saltos e por fluxo\n"
+          "  --trace ARQUIVO            grava o ciclo de vida das mensagens em JSON (chrome://tracing)\n"
+          "  --verbose                  imprime cada timeout\n");
+}
+
+static void PrintLatencyLine(const char *label, const LatencyHistogram *h)
+{
+  printf("  %-10s %8lld msgs | p50 %.2f | p99 %.2f | max %.2f ms\n", label, h->total, LatencyPercentile(h, 50.0) * 1000.0,
+         LatencyPercentile(h, 99.0) * 1000.0, h->maxMicros / 1000.0);
+}
+
+// Mais tempo saturada primeiro; empate pelo tempo ocupada e depois pelo id.
+static int CompareBusyEdges(const void *a, const void *b)
+{
+  const EdgeState *x = &edgeState[*(const int *)a], *y = &edgeState[*(const int *)b];
+  if (x->saturatedSeconds != y->saturatedSeconds)
+    return x->saturatedSeconds < y->saturatedSeconds ? 1 : -1;
+  if (x->busySeconds != y->busySeconds)
+    return x->busySeconds < y->busySeconds ? 1 : -1;
+  return *(const int *)a - *(const int *)b;
+}
+
+// Arestas dirigidas que mais tempo passaram na capacidade, com o resto dos contadores.
+void PrintBusiestLinks(int count)
+{
+  int *edges = GrowColumn(NULL, sizeof(*edges), graph.edgeCount > 0 ? graph.edgeCount : 1);
+  int live = 0;
+  for (int e = 0; e < graph.edgeCount; e++)
+    if (graph.edgeAlive[e])
+    {
+      SettleEdgeBusy(&edgeState[e]);
+      edges[live++] = e;
+    }
+  qsort(edges, live, sizeof(*edges), CompareBusyEdges);
+  printf("Ligacoes mais ocupadas:\n");
+  for (int k = 0; k < live && k < count; k++)
+  {
+    const EdgeState *es = &edgeState[edges[k]];
+    double seconds = simTime > 0.0 ? simTime : 1.0;
+    printf("  %d->%d: ocupada %.1f%% | saturada %.1f%% | %lld msgs | pico %d/%d\n", graph.edgeFrom[edges[k]], graph.edgeTo[edges[k]],
+           100.0 * es->busySeconds / seconds, 100.0 * es->saturatedSeconds / seconds, (long long)es->messagesCarried,
+           es->peakLoad, es->capacity);
+  }
+  free(edges);
+}
+
+static int CompareFlows(const void *a, const void *b)
+{
+  const FlowLatency *x = a, *y = b;
+  return x->from != y->from ? x->from - y->from : x->to - y->to;
+}
+
+void PrintLatencyBreakdown(void)
+{
+  char label[32];
+  printf("Latencia por saltos:\n");
+  for (int i = 0; i < LATENCY_HOP_CLASSES; i++)
+    if (latencyByHops[i] != NULL)
+    {
+      sprintf(label, i + 1 == LATENCY_HOP_CLASSES ? "%d+" : "%d", i + 1);
+      PrintLatencyLine(label, latencyByHops[i]);
+    }
+  // Ordena uma cópia compacta para a saída não depender da ordem do hash
+  FlowLatency *flows = GrowColumn(NULL, sizeof(*flows), flowLatencyCount > 0 ? flowLatencyCount : 1);
+  int count = 0;
+  for (int i = 0; i < flowLatencyCapacity; i++)
+    if (flowLatency[i].hist != NULL)
+      flows[count++] = flowLatency[i];
+  qsort(flows, count, sizeof(*flows), CompareFlows);
+  printf("Latencia por fluxo:\n");
+  for (int i = 0; i < count; i++)
+  {
+    sprintf(label, "%d->%d", flows[i].from, flows[i].to);
+    PrintLatencyLine(label, flows[i].hist);
+  }
+  free(flows);
+}
+
+// Colunas de --csv, na mesma ordem da linha impressa por RunHeadless.
+void PrintCsvHeader(void)
+{
+  printf("topology,nodes,links,degree,capacity,speed,timeout_s,release_s,burst_size,seed,sent,completed,in_flight,no_route,timeouts,"
+         "throughput_msg_s,avg_ms,p50_ms,p90_ms,p99_ms,p999_ms,max_ms,sim_seconds\n");
+}
+
+// Relatório legível do modo headless, com as mesmas grandezas de DrawStatistics e mais.
+void PrintHeadlessReport(Statistics st, unsigned int seed, const char *topology, const char *workloadName, long long steps,
+                         double wallSeconds)
+{
+  printf("--- Estatisticas ---\n");
+  printf("Semente: %u | Topologia: %s (%d nos, %d ligacoes) | Carga: %s\n", seed, topology, nodeCount, graph.edgeCount / 2,
+         workloadName);
+  printf("Tempo simulado: %.2f s (%lld passos) | Tempo real: %.3f s\n", st.simSeconds, steps, wallSeconds);
+  printf("Motor: %lld eventos em %.3f s | %.0fx tempo real | %d threads\n", engine_events_processed, engine_wall_seconds, st.engineSpeedup, simThreads);
+  printf("Msgs Enviadas: %d\n", sent_messages_count);
+  printf("Msgs Concluidas: %d\n", st.completed);
+  printf("Msgs Em Andamento: %d\n", st.inFlight);
+  printf("Msgs Sem Rota: %d\n", st.noRoute);
+  printf("Latencia: %.2f ms\n", st.avgLatencyMs);
+  printf("Latencia p50/p90/p99/p99.9/max: %.2f / %.2f / %.2f / %.2f / %.2f ms\n", st.p50Ms, st.p90Ms, st.p99Ms, st.p999Ms, st.maxLatencyMs);
+  if (latencyBreakdown)
+    PrintLatencyBreakdown();
+  printf("Timeouts: %d\n", st.timeouts);
+  printf("Vazao: %.2f msg/s\n", st.throughput);
+  printf("Filas: origem %d | ACK %d | intermediarias %d\n", st.queued[QUEUE_ORIGIN], st.queued[QUEUE_ACK], st.queued[QUEUE_INTERMEDIATE]);
+  long long routeLookups = route_cache_hits + route_cache_misses;
+  printf("Cache de rotas: %.1f%% acertos (%lld consultas)\n", routeLookups ? 100.0 * route_cache_hits / routeLookups : 0.0, routeLookups);
+  PrintBusiestLinks(5);
+}
+
+// Executa a simulação sem InitWindow, avançando o motor com passo fixo até a
+// carga terminar e a rede esvaziar (ou até 'duration'), e imprime as mesmas
+// estatísticas que DrawStatistics mostra.
+int RunHeadless(int argc, char **argv)
+{
+  const char *topology = "default";
+  const char *workloadName = "burst";
+  int from = 0, to = 13, count = 50, rounds = 10, burstSize = 10;
+  float interval = MESSAGE_INTERVAL, dt = 1.0f / 60.0f, release = 0.1f;
+  double duration = 600.0;
+  unsigned int seed = (unsigned int)time(NULL);
+  int topologyNodes = 1024, degree = 4;
+  const char *topologySeed = NULL;
+  const char *topologyFile = NULL, *saveTopology = NULL;
+  int threads = 1;
+  const char *tracePath = NULL;
+  bool csv = false;
+
+  logTimeouts = false;
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--verbose") == 0)
+    {
+      logTimeouts = true;
+      continue;
+    }
+    if (strcmp(arg, "--latency-breakdown") == 0)
+    {
+      latencyBreakdown = true;
+      continue;
+    }
+    if (strcmp(arg, "--csv") == 0)
+    {
+      csv = true;
+      continue;
+    }
+    const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (val == NULL)
+    {
+      PrintHeadlessUsage();
+      return 1;
+    }
+    if (strcmp(arg, "--topology") == 0)
+      topology = val;
+    else if (strcmp(arg, "--nodes") == 0)
+      topologyNodes = atoi(val);
+    else if (strcmp(arg, "--degree") == 0)
+      degree = atoi(val);
+    else if (strcmp(arg, "--topology-seed") == 0)
+      topologySeed = val;
+    else if (strcmp(arg, "--topology-file") == 0)
+      topologyFile = val;
+    else if (strcmp(arg, "--save-topology") == 0)
+      saveTopology = val;
+    else if (strcmp(arg, "--workload") == 0)
+      workloadName = val;
+    else if (strcmp(arg, "--from") == 0)
+      from = atoi(val);
+    else if (strcmp(arg, "--to") == 0)
+      to = atoi(val);
+    else if (strcmp(arg, "--count") == 0)
+      count = atoi(val);
+    else if (strcmp(arg, "--rounds") == 0)
+      rounds = atoi(val);
+    else if (strcmp(arg, "--burst-size") == 0)
+      burstSize = atoi(val);
+    else if (strcmp(arg, "--interval") == 0)
+      interval = (float)atof(val);
+    else if (strcmp(arg, "--duration") == 0)
+      duration = atof(val);
+    else if (strcmp(arg, "--dt") == 0)
+      dt = (float)atof(val);
+    else if (strcmp(arg, "--release") == 0)
+      release = (float)atof(val);
+    else if (strcmp(arg, "--seed") == 0)
+      seed = (unsigned int)strtoul(val, NULL, 10);
+    else if (strcmp(arg, "--threads") == 0)
+      threads = atoi(val);
+    else if (strcmp(arg, "--trace") == 0)
+      tracePath = val;
+    else if (strcmp(arg, "--capacity") == 0)
+      linkCapacity = atoi(val);
+    else if (strcmp(arg, "--speed") == 0)
+      messageSpeed = (float)atof(val);
+    else if (strcmp(arg, "--timeout") == 0)
+      timeoutSeconds = (float)atof(val);
+    else
+    {
+      PrintHeadlessUsage();
+      return 1;
+    }
+    i++;
+  }
+  if (dt <= 0.0f || duration <= 0.0 || threads < 1 || linkCapacity < 1 || messageSpeed <= 0.0f || timeoutSeconds <= 0.0f ||
+      topologyNodes < 2 || topologyNodes > TOPOLOGY_MAX_NODES || degree < 1)
+  {
+    PrintHeadlessUsage();
+    return 1;
+  }
+
+  srand(seed);
+  StartWorkerPool(threads);
+  unsigned int networkSeed = topologySeed ? (unsigned int)strtoul(topologySeed, NULL, 10) : seed;
+  if (topologyFile != NULL)
+  {
+    if (!LoadTopologyFile(topologyFile))
+      return 1;
+    topology = topologyFile;
+  }
+  else if (!CreateTopology(topology, topologyNodes, degree, networkSeed))
+  {
+    fprintf(stderr, "Topologia desconhecida: %s\n", topology);
+    return 1;
+  }
+  if (saveTopology != NULL && !SaveTopologyFile(saveTopology))
+    return 1;
 
-  m->pathLength = BuildPath(from, to, m->path, MAX_NODES);
+  if (tracePath != NULL)
+    StartTrace(TRACE_RING_RECORDS);
 
-  if (m->pathLength > 1)
+  Workload workload = CreateWorkload();
+  workload.interval = interval;
+  workload.totalBurstRounds = rounds;
+  workload.burstSize = burstSize;
+  if (strcmp(workloadName, "stream") == 0)
   {
-    int first_hop_node = m->path[1];
-    if (capacityNetwork.graph[from][first_hop_node] < MAX_CAPACITY_PER_LINK)
+    if (from < 0 || to < 0 || from >= nodeCount || to >= nodeCount)
     {
-      m->state = SENDING;
-      m->queuedAtNodeId = -1;
-      pathfindingNetwork.graph[from][first_hop_node]++;
-      capacityNetwork.graph[from][first_hop_node]++;
-      m->last_sent_time = clock();
-    }
-    else
-    {
-      m->state = QUEUED;
-      m->queuedAtNodeId = from;
+      fprintf(stderr, "No invalido: %d->%d\n", from, to);
+      return 1;
     }
+    StartStream(&workload, from, to, count);
   }
+  else if (strcmp(workloadName, "burst") == 0)
+    StartBurst(&workload);
   else
   {
-    m->state = QUEUED;
-    m->queuedAtNodeId = from;
+    fprintf(stderr, "Carga desconhecida: %s\n", workloadName);
+    return 1;
   }
-  messageCount++;
-}
 
-void UpdateAsyncMessages(float dt, float releaseInterval)
-{
-  static float nodeReleaseCooldown[MAX_NODES] = {0.0f};
-  for (int i = 0; i < nodeCount; i++)
-    if (nodeReleaseCooldown[i] > 0)
-      nodeReleaseCooldown[i] -= dt;
-  clock_t now = clock();
-
-  for (int i = 0; i < messageCount; i++)
+  double wallStart = WallSeconds();
+  long long steps = 0;
+  while (simTime < duration)
   {
-    AsyncMessage *m = &messages[i];
-    if (m->state == DONE)
-      continue;
-
-    if ((m->state != QUEUED || m->queuedAtNodeId != m->from) && m->last_sent_time > 0)
+    float step = dt;
+    if (WorkloadFinished(&workload))
     {
-      if (((double)(now - m->last_sent_time) / CLOCKS_PER_SEC) > TIMEOUT_SECONDS)
-      {
-        printf("!!! TIMEOUT da Mensagem %d (%d->%d) !!!\n", i, m->from, m->to);
-        total_retransmissions++;
-
-        if (m->state == SENDING)
-        {
-          int prevNode = m->path[m->currentSegment];
-          int nextNode = m->path[m->currentSegment + 1];
-          if (pathfindingNetwork.graph[prevNode][nextNode] > 0)
-            pathfindingNetwork.graph[prevNode][nextNode]--;
-          if (capacityNetwork.graph[prevNode][nextNode] > 0)
-            capacityNetwork.graph[prevNode][nextNode]--;
-        }
-        else if (m->state == ACK_RECEIVING)
-        {
-          int prevNode = m->ackPath[m->currentAckSegment];
-          int nextNode = m->ackPath[m->currentAckSegment + 1];
-          if (pathfindingNetwork.graph[prevNode][nextNode] > 0)
-            pathfindingNetwork.graph[prevNode][nextNode]--;
-          if (capacityNetwork.graph[prevNode][nextNode] > 0)
-            capacityNetwork.graph[prevNode][nextNode]--;
-        }
-
-        m->state = QUEUED;
-        m->queuedAtNodeId = m->from;
-        m->retransmission_count++;
-        m->pathLength = 0;
-        m->ackPathLength = 0;
-        m->progress = 0;
-        m->currentSegment = 0;
-        continue;
-      }
+      // Sem novas mensagens a enviar: pula direto para o próximo evento. Sem
+      // eventos pendentes, as mensagens ativas que restam estão todas na espera
+      // por rota: a topologia não muda mais e elas não têm temporizador armado,
+      // então saem no relatório como "Sem Rota" em vez de ficarem esperando.
+      if (!HasPendingEvents() || activeCount == 0)
+        break;
+      double next = NextEventTime();
+      if (next > duration)
+        next = duration;
+      if (next - simTime > step)
+        step = (float)(next - simTime);
     }
+    UpdateWorkload(&workload, step);
+    UpdateAsyncMessages(step, release);
+    steps++;
+  }
+  double wallSeconds = WallSeconds() - wallStart;
 
-    if (m->state == SENDING || m->state == ACK_RECEIVING)
-      m->progress += dt * MESSAGE_SPEED;
+  Statistics st = ComputeStatistics();
+  if (csv)
+  {
+    PrintCsvHeader();
+    printf("%s,%d,%d,%d,%d,%g,%g,%g,%d,%u,%d,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", topology, nodeCount,
+           graph.edgeCount / 2, degree, linkCapacity, messageSpeed, timeoutSeconds, release, burstSize, seed, sent_messages_count, st.completed, st.inFlight, st.noRoute, st.timeouts,
+           st.throughput, st.avgLatencyMs, st.p50Ms, st.p90Ms, st.p99Ms, st.p999Ms, st.maxLatencyMs, st.simSeconds);
+  }
+  else
+    PrintHeadlessReport(st, seed, topology, workloadName, steps, wallSeconds);
+  if (tracePath != NULL)
+  {
+    long long records = ExportChromeTrace(tracePath);
+    if (records >= 0 && !csv)
+      printf("Trace: %lld registros em %s\n", records, tracePath);
+    StopTrace();
+  }
+  return 0;
+}
 
-    switch (m->state)
-    {
-    case SENDING:
-      if (m->progress >= 1.0f)
-      {
-        m->progress -= 1.0f;
-        int prevNodeId = m->path[m->currentSegment];
-        m->currentSegment++;
-        int currentNodeId = m->path[m->currentSegment];
+//====================================================================================
+// VARREDURA DE PARÂMETROS (--sweep)
+//====================================================================================
+// O estado do motor é global e compartilhado com o pool do passo paralelo,
+// então cada configuração roda isolada num processo próprio: a varredura
+// chama este mesmo executável com --headless --csv, mantendo até --jobs
+// filhos ao mesmo tempo, e junta as linhas CSV na ordem das configurações.
 
-        pathfindingNetwork.graph[prevNodeId][currentNodeId]--;
-        capacityNetwork.graph[prevNodeId][currentNodeId]--;
+#define SWEEP_MAX_VALUES 64    // Valores por parâmetro
+#define SWEEP_MAX_CONFIGS 100000
 
-        if (currentNodeId == m->to)
-        {
-          m->state = QUEUED;
-          m->queuedAtNodeId = m->to;
-        }
-        else
-        {
-          int nextNodeId = m->path[m->currentSegment + 1];
-          if (capacityNetwork.graph[currentNodeId][nextNodeId] < MAX_CAPACITY_PER_LINK)
-          {
-            pathfindingNetwork.graph[currentNodeId][nextNodeId]++;
-            capacityNetwork.graph[currentNodeId][nextNodeId]++;
-          }
-          else
-          {
-            m->state = QUEUED;
-            m->queuedAtNodeId = currentNodeId;
-          }
-        }
-      }
-      break;
-    case ACK_RECEIVING:
-      if (m->progress >= 1.0f)
-      {
-        m->progress -= 1.0f;
-        int prevNodeId = m->ackPath[m->currentAckSegment];
-        m->currentAckSegment++;
-        int currentNodeId = m->ackPath[m->currentAckSegment];
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
 
-        pathfindingNetwork.graph[prevNodeId][currentNodeId]--;
-        capacityNetwork.graph[prevNodeId][currentNodeId]--;
+typedef struct SweepParam
+{
+  const char *option; // Opção do modo headless
+  bool integer;
+  double values[SWEEP_MAX_VALUES];
+  int count; // 0 = não varrido, o filho usa o padrão
+} SweepParam;
 
-        if (currentNodeId == m->from)
-        {
-          m->state = DONE;
-          m->completion_time = clock();
-          total_latency_ticks += (m->completion_time - m->creation_time);
-          completed_messages_count++;
-        }
-        else
-        {
-          int nextNodeId = m->ackPath[m->currentAckSegment + 1];
-          if (capacityNetwork.graph[currentNodeId][nextNodeId] < MAX_CAPACITY_PER_LINK)
-          {
-            pathfindingNetwork.graph[currentNodeId][nextNodeId]++;
-            capacityNetwork.graph[currentNodeId][nextNodeId]++;
-          }
-          else
-          {
-            m->state = QUEUED;
-            m->queuedAtNodeId = currentNodeId;
-          }
-        }
-      }
-      break;
-    case QUEUED:
-    {
-      int nodeId = m->queuedAtNodeId;
-      if (nodeId != -1 && nodeReleaseCooldown[nodeId] <= 0)
-      {
-        if (nodeId == m->from)
-        {
-          m->pathLength = BuildPath(m->from, m->to, m->path, MAX_NODES);
-          if (m->pathLength > 1)
-          {
-            int nextNodeId = m->path[1];
-            if (capacityNetwork.graph[nodeId][nextNodeId] < MAX_CAPACITY_PER_LINK)
-            {
-              m->state = SENDING;
-              m->queuedAtNodeId = -1;
-              m->last_sent_time = clock();
-              m->progress = 0;
-              pathfindingNetwork.graph[nodeId][nextNodeId]++;
-              capacityNetwork.graph[nodeId][nextNodeId]++;
-              nodeReleaseCooldown[nodeId] = releaseInterval;
-            }
-          }
-        }
-        else if (nodeId == m->to)
-        {
-          m->ackPathLength = BuildPath(m->to, m->from, m->ackPath, MAX_NODES);
-          if (m->ackPathLength > 1)
-          {
-            int nextNodeId = m->ackPath[1];
-            if (capacityNetwork.graph[nodeId][nextNodeId] < MAX_CAPACITY_PER_LINK)
-            {
-              m->state = ACK_RECEIVING;
-              m->currentAckSegment = 0;
-              m->queuedAtNodeId = -1;
-              m->progress = 0;
-              pathfindingNetwork.graph[nodeId][nextNodeId]++;
-              capacityNetwork.graph[nodeId][nextNodeId]++;
-              nodeReleaseCooldown[nodeId] = releaseInterval;
-            }
-          }
-        }
-        else
-        {
-          int nextNodeId = (m->pathLength > 0) ? m->path[m->currentSegment + 1] : m->ackPath[m->currentAckSegment + 1];
-          if (capacityNetwork.graph[nodeId][nextNodeId] < MAX_CAPACITY_PER_LINK)
-          {
-            m->state = (m->pathLength > 0) ? SENDING : ACK_RECEIVING;
-            m->queuedAtNodeId = -1;
-            m->progress = 0;
-            pathfindingNetwork.graph[nodeId][nextNodeId]++;
-            capacityNetwork.graph[nodeId][nextNodeId]++;
-            nodeReleaseCooldown[nodeId] = releaseInterval;
-          }
-        }
-      }
-      break;
-    }
-    case DONE:
-      break;
-    }
-  }
-}
+SweepParam sweepParams[] = {
+    {.option = "--capacity", .integer = true},
+    {.option = "--speed"},
+    {.option = "--timeout"},
+    {.option = "--release"},
+    {.option = "--burst-size", .integer = true},
+    {.option = "--seed", .integer = true},
+    {.option = "--nodes", .integer = true},
+    {.option = "--degree", .integer = true},
+};
+#define SWEEP_PARAM_COUNT ((int)(sizeof(sweepParams) / sizeof(sweepParams[0])))
 
-void SendOneBurstRound()
+typedef struct Sweep
 {
-  const int streamsPerRound = 10;
-  if (nodeCount == 0)
-    return;
-  for (int i = 0; i < streamsPerRound; i++)
-  {
-    int from = rand() % nodeCount;
-    int to = rand() % nodeCount;
-    while (from == to)
-    {
-      to = rand() % nodeCount;
-    }
-    AddAsyncMessage(from, to);
-  }
-}
+  char commandBase[4096]; // Executável, --headless, --csv e as opções fixas
+  int configCount;
+  _Atomic int nextConfig;
+  char **rows; // Linha CSV de cada configuração, ou NULL se o filho falhou
+} Sweep;
 
-//====================================================================================
-// FUNÇÕES DE VISUALIZAÇÃO E MAIN
-//====================================================================================
+Sweep sweep;
 
-void PrintNonCompletedMessages()
+int CpuCount(void)
 {
-  printf("\n---[ Status das Mensagens Nao Concluidas ]---\n");
-  int notDoneCount = 0;
-  for (int i = 0; i < messageCount; i++)
-  {
-    if (messages[i].state != DONE)
-    {
-      notDoneCount++;
-      const char *stateStr;
-      switch (messages[i].state)
-      {
-      case SENDING:
-        stateStr = "ENVIANDO";
-        break;
-      case ACK_RECEIVING:
-        stateStr = "RECEBENDO ACK";
-        break;
-      case QUEUED:
-        stateStr = "ENFILEIRADA";
-        break;
-      default:
-        stateStr = "DESCONHECIDO";
-        break;
-      }
-      printf("Msg[%d]: De %d->%d | Estado: %-15s", i, messages[i].from, messages[i].to, stateStr);
-      if (messages[i].state == QUEUED)
-      {
-        printf("| Local: No %d\n", messages[i].queuedAtNodeId);
-      }
-      else if (messages[i].state == SENDING)
-      {
-        printf("| Progresso: %.2f | Segmento: %d de %d\n", messages[i].progress, messages[i].currentSegment, messages[i].pathLength - 1);
-      }
-      else if (messages[i].state == ACK_RECEIVING)
-      {
-        printf("| Progresso: %.2f | Segmento ACK: %d de %d\n", messages[i].progress, messages[i].currentAckSegment, messages[i].ackPathLength - 1);
-      }
-    }
-  }
-  if (notDoneCount == 0)
-    printf("Todas as mensagens foram concluidas com sucesso.\n");
-  else
-    printf("Total de mensagens nao concluidas: %d\n", notDoneCount);
-  printf("---[ Fim do Relatorio ]---\n\n");
+#ifdef _WIN32
+  const char *env = getenv("NUMBER_OF_PROCESSORS");
+  long n = env != NULL ? atol(env) : 1;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return n > 0 ? (int)n : 1;
 }
 
-void DrawNetwork()
+// Lê "a,b,c" ou "inicio:fim:passo" (fim incluso). Retorna false se inválido.
+static bool ParseSweepValues(SweepParam *p, const char *text)
 {
-  for (int i = 0; i < nodeCount; i++)
+  double start, end, step;
+  p->count = 0;
+  if (sscanf(text, "%lf:%lf:%lf", &start, &end, &step) == 3)
   {
-    for (int j = 0; j < nodes[i].connectionCount; j++)
+    if (step <= 0.0 || end < start)
+      return false;
+    for (double v = start; v <= end + step * 1e-9; v += step)
     {
-      int b = nodes[i].connections[j];
-      if (b > i)
-        DrawLine(nodes[i].x, nodes[i].y, nodes[b].x, nodes[b].y, GRAY);
+      if (p->count == SWEEP_MAX_VALUES)
+        return false;
+      p->values[p->count++] = v;
     }
+    return true;
   }
-  for (int i = 0; i < nodeCount; i++)
+  const char *cursor = text;
+  while (*cursor != '\0')
   {
-    DrawCircle(nodes[i].x, nodes[i].y, NODE_RADIUS, BLUE);
-    char label[8];
-    sprintf(label, "%d", nodes[i].id);
-    DrawText(label, nodes[i].x - 5, nodes[i].y - 10, 20, WHITE);
+    char *after;
+    double v = strtod(cursor, &after);
+    if (after == cursor || p->count == SWEEP_MAX_VALUES)
+      return false;
+    p->values[p->count++] = v;
+    cursor = *after == ',' ? after + 1 : after;
+    if (*after != ',' && *after != '\0')
+      return false;
   }
+  return p->count > 0;
 }
 
-void DrawTravelingMessages()
+// Acrescenta ao comando o argumento entre aspas simples, com cada ' escrito
+// como '\'' para que o shell não interprete $, ` nem ". O cmd.exe do Windows
+// não entende aspas simples e recebe aspas duplas. Retorna false (sem alterar
+// o comando) se não couber.
+static bool AppendArgument(char *command, size_t size, const char *arg)
 {
-  for (int i = 0; i < messageCount; i++)
+  size_t used = strlen(command);
+#ifdef _WIN32
+  int written = snprintf(command + used, size - used, " \"%s\"", arg);
+  if (written >= 0 && (size_t)written < size - used)
+    return true;
+  command[used] = '\0';
+  return false;
+#else
+  size_t start = used;
+  if (used + 4 > size) // " ''" e o '\0'
+    return false;
+  command[used++] = ' ';
+  command[used++] = '\'';
+  for (; *arg != '\0'; arg++)
   {
-    AsyncMessage *m = &messages[i];
-    if (m->state != SENDING && m->state != ACK_RECEIVING)
-      continue;
-    Vector2 start, end, pos;
-    Color color;
-    if (m->state == SENDING)
+    size_t need = *arg == '\'' ? 4 : 1;
+    if (used + need + 2 > size) // Ainda cabem a aspa final e o '\0'
     {
-      start = (Vector2){nodes[m->path[m->currentSegment]].x, nodes[m->path[m->currentSegment]].y};
-      end = (Vector2){nodes[m->path[m->currentSegment + 1]].x, nodes[m->path[m->currentSegment + 1]].y};
-      color = RED;
+      command[start] = '\0';
+      return false;
     }
+    if (*arg == '\'')
+      memcpy(command + used, "'\\''", 4);
     else
-    {
-      start = (Vector2){nodes[m->ackPath[m->currentAckSegment]].x, nodes[m->ackPath[m->currentAckSegment]].y};
-      end = (Vector2){nodes[m->ackPath[m->currentAckSegment + 1]].x, nodes[m->ackPath[m->currentAckSegment + 1]].y};
-      color = GREEN;
-    }
-    pos = (Vector2){start.x + (end.x - start.x) * m->progress, start.y + (end.y - start.y) * m->progress};
-    DrawCircleV(pos, 8, color);
-    DrawCircleLines(pos.x, pos.y, 8, BLACK);
+      command[used] = *arg;
+    used += need;
   }
+  command[used++] = '\'';
+  command[used] = '\0';
+  return true;
+#endif
 }
 
-void DrawQueuedMessages()
+static void *SweepWorker(void *arg)
 {
-  int originQueueCounts[MAX_NODES] = {0};
-  int ackQueueCounts[MAX_NODES] = {0};
-  int intermediateQueueCounts[MAX_NODES] = {0};
-  for (int i = 0; i < messageCount; i++)
+  (void)arg;
+  char command[sizeof(sweep.commandBase) + 512];
+  char line[1024], last[1024];
+  while (1)
   {
-    if (messages[i].state == QUEUED && messages[i].queuedAtNodeId != -1)
+    int config = atomic_fetch_add(&sweep.nextConfig, 1);
+    if (config >= sweep.configCount)
+      return NULL;
+    // Decompõe o índice em um valor de cada parâmetro varrido
+    strcpy(command, sweep.commandBase);
+    int rest = config;
+    bool fits = true;
+    for (int i = SWEEP_PARAM_COUNT - 1; i >= 0 && fits; i--)
     {
-      int nodeId = messages[i].queuedAtNodeId;
-      if (nodeId == messages[i].from)
-        originQueueCounts[nodeId]++;
-      else if (nodeId == messages[i].to)
-        ackQueueCounts[nodeId]++;
+      const SweepParam *p = &sweepParams[i];
+      if (p->count == 0)
+        continue;
+      double v = p->values[rest % p->count];
+      rest /= p->count;
+      char value[32];
+      if (p->integer)
+        sprintf(value, "%lld", llround(v));
       else
-        intermediateQueueCounts[nodeId]++;
+        sprintf(value, "%g", v);
+      fits = AppendArgument(command, sizeof(command), p->option) &&
+             AppendArgument(command, sizeof(command), value);
     }
-  }
-  for (int nodeId = 0; nodeId < nodeCount; nodeId++)
-  {
-    Node *node = &nodes[nodeId];
-    bool hasOriginQueue = originQueueCounts[nodeId] > 0 || intermediateQueueCounts[nodeId] > 0;
-    bool hasAckQueue = ackQueueCounts[nodeId] > 0;
-    if (hasOriginQueue)
+    // Um comando truncado rodaria outra configuração: a linha fica de fora
+    if (!fits)
     {
-      Vector2 pos = {node->x + QUEUE_OFFSET_X + 10, node->y - (NODE_RADIUS / 2.0f)};
-      DrawCircleV(pos, 8, RED);
-      DrawCircleLines(pos.x, pos.y, 8, BLACK);
-      char countText[16];
-      sprintf(countText, "%d", originQueueCounts[nodeId] + intermediateQueueCounts[nodeId]);
-      DrawText(countText, pos.x + 12, pos.y - 8, 20, BLACK);
+      fprintf(stderr, "Configuracao %d: linha de comando longa demais\n", config);
+      continue;
     }
-    if (hasAckQueue)
+    FILE *child = popen(command, "r");
+    last[0] = '\0';
+    if (child != NULL)
     {
-      Vector2 pos = {node->x + QUEUE_OFFSET_X + 10, node->y + (NODE_RADIUS / 2.0f)};
-      DrawCircleV(pos, 8, GREEN);
-      DrawCircleLines(pos.x, pos.y, 8, BLACK);
-      char countText[16];
-      sprintf(countText, "%d", ackQueueCounts[nodeId]);
-      DrawText(countText, pos.x + 12, pos.y - 8, 20, BLACK);
+      while (fgets(line, sizeof(line), child) != NULL)
+        if (line[0] != '\n')
+          strcpy(last, line);
+      if (pclose(child) != 0)
+        last[0] = '\0';
+    }
+    if (last[0] == '\0')
+      fprintf(stderr, "Configuracao %d falhou: %s\n", config, command);
+    else
+    {
+      last[strcspn(last, "\r\n")] = '\0';
+      sweep.rows[config] = GrowColumn(NULL, strlen(last) + 1, 1);
+      strcpy(sweep.rows[config], last);
     }
   }
 }
 
-void DrawUI(Rectangle uiArea, int *uiFromNode, int *uiToNode, int *uiMsgCount, bool *sendPressed)
+void PrintSweepUsage(void)
 {
-  static char fromText[8] = "0";
-  static char toText[8] = "13";
-  static char msgText[8] = "50";
-  static int activeBox = -1;
-  DrawRectangleRec(uiArea, (Color){200, 200, 200, 180});
-  DrawRectangleLinesEx(uiArea, 2, DARKGRAY);
-  int startX = uiArea.x + 10;
-  int startY = uiArea.y + 10;
-  int boxW = 60, boxH = 30, spacing = 40;
-  DrawText("Origem:", startX, startY, 20, DARKGRAY);
-  DrawText("Destino:", startX, startY + spacing, 20, DARKGRAY);
-  DrawText("Qtd:", startX, startY + 2 * spacing, 20, DARKGRAY);
-  Rectangle boxFrom = {startX + 100, startY, boxW, boxH};
-  Rectangle boxTo = {startX + 100, startY + spacing, boxW, boxH};
-  Rectangle boxMsg = {startX + 100, startY + 2 * spacing, boxW, boxH};
-  if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
-  {
-    if (CheckCollisionPointRec(GetMousePosition(), boxFrom))
-      activeBox = 0;
-    else if (CheckCollisionPointRec(GetMousePosition(), boxTo))
-      activeBox = 1;
-    else if (CheckCollisionPointRec(GetMousePosition(), boxMsg))
-      activeBox = 2;
-    else if (!CheckCollisionPointRec(GetMousePosition(), uiArea))
-      activeBox = -1;
-  }
-  if (activeBox != -1)
+  fprintf(stderr,
+          "Uso: app --sweep [--jobs N] [parametros] [opcoes do --headless]\n"
+          "  Cada parametro aceita uma lista (10,20,40) ou um intervalo inicio:fim:passo:\n"
+          "  --capacity --speed --timeout --release --burst-size --seed --nodes --degree\n"
+          "  --jobs N   processos simultaneos (padrao: numero de nucleos)\n"
+          "  As demais opcoes sao repassadas a cada execucao --headless.\n"
+          "  Cada configuracao roda num processo proprio (este executavel com --headless\n"
+          "  --csv), lancado com popen pelo shell do sistema; os argumentos vao entre\n"
+          "  aspas simples (aspas duplas no Windows).\n"
+          "  Saida: CSV em stdout, uma linha por configuracao.\n");
+}
+
+int RunSweep(const char *executable, int argc, char **argv)
+{
+  int jobs = CpuCount();
+  sweep.commandBase[0] = '\0';
+  bool fits = AppendArgument(sweep.commandBase, sizeof(sweep.commandBase), executable) &&
+              AppendArgument(sweep.commandBase, sizeof(sweep.commandBase), "--headless") &&
+              AppendArgument(sweep.commandBase, sizeof(sweep.commandBase), "--csv");
+  for (int i = 1; i < argc && fits; i++)
   {
-    char *target = NULL;
-    if (activeBox == 0)
-      target = fromText;
-    if (activeBox == 1)
-      target = toText;
-    if (activeBox == 2)
-      target = msgText;
-    SetMouseCursor(MOUSE_CURSOR_IBEAM);
-    int key = GetCharPressed();
-    while (key > 0)
+    const char *arg = argv[i];
+    const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (strcmp(arg, "--jobs") == 0 && val != NULL)
     {
-      if (key >= '0' && key <= '9' && (strlen(target) < 7))
-      {
-        int len = strlen(target);
-        target[len] = (char)key;
-        target[len + 1] = '\0';
-      }
-      key = GetCharPressed();
+      jobs = atoi(val);
+      i++;
+      continue;
     }
-    if (IsKeyPressed(KEY_BACKSPACE))
+    SweepParam *param = NULL;
+    for (int k = 0; k < SWEEP_PARAM_COUNT; k++)
+      if (strcmp(arg, sweepParams[k].option) == 0)
+        param = &sweepParams[k];
+    if (param != NULL)
     {
-      int len = strlen(target);
-      if (len > 0)
-        target[len - 1] = '\0';
+      if (val == NULL || !ParseSweepValues(param, val))
+      {
+        fprintf(stderr, "Valores invalidos para %s\n", arg);
+        return 1;
+      }
+      i++;
+      continue;
     }
+    fits = AppendArgument(sweep.commandBase, sizeof(sweep.commandBase), arg);
   }
-  else
-  {
-    SetMouseCursor(MOUSE_CURSOR_DEFAULT);
-  }
-  DrawRectangleLinesEx(boxFrom, 2, (activeBox == 0) ? RED : DARKGRAY);
-  DrawText(fromText, boxFrom.x + 5, boxFrom.y + 5, 20, BLACK);
-  DrawRectangleLinesEx(boxTo, 2, (activeBox == 1) ? RED : DARKGRAY);
-  DrawText(toText, boxTo.x + 5, boxTo.y + 5, 20, BLACK);
-  DrawRectangleLinesEx(boxMsg, 2, (activeBox == 2) ? RED : DARKGRAY);
-  DrawText(msgText, boxMsg.x + 5, boxMsg.y + 5, 20, BLACK);
-  Rectangle btn = {startX, startY + 3 * spacing, boxW + 100, boxH};
-  DrawRectangleRec(btn, LIGHTGRAY);
-  DrawRectangleLinesEx(btn, 2, DARKGRAY);
-  DrawText("Enviar", btn.x + 10, btn.y + 5, 20, BLACK);
-  if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && CheckCollisionPointRec(GetMousePosition(), btn))
+  if (!fits || jobs < 1)
   {
-    *uiFromNode = atoi(fromText);
-    *uiToNode = atoi(toText);
-    *uiMsgCount = atoi(msgText);
-    *sendPressed = true;
+    PrintSweepUsage();
+    return 1;
   }
-}
-
-// ALTERADO: Função de estatísticas agora inclui o cálculo e a exibição da VAZÃO (Throughput).
-void DrawStatistics(int screenW)
-{
-  // Aumenta a altura da área para caber a nova estatística
-  Rectangle statsArea = {screenW - 270, 200, 260, 180};
-  DrawRectangleRec(statsArea, (Color){220, 220, 220, 190});
-  DrawRectangleLinesEx(statsArea, 2, DARKGRAY);
-
-  DrawText("--- Estatisticas ---", statsArea.x + 10, statsArea.y + 10, 20, BLACK);
 
-  // Calcula a latência média (código existente)
-  float avg_latency_ms = 0;
-  if (completed_messages_count > 0)
+  long long configs = 1;
+  for (int k = 0; k < SWEEP_PARAM_COUNT; k++)
+    if (sweepParams[k].count > 0)
+      configs *= sweepParams[k].count;
+  if (configs > SWEEP_MAX_CONFIGS)
   {
-    avg_latency_ms = ((float)total_latency_ticks / completed_messages_count / CLOCKS_PER_SEC) * 1000.0f;
+    fprintf(stderr, "Configuracoes demais: %lld (maximo %d)\n", configs, SWEEP_MAX_CONFIGS);
+    return 1;
   }
-
-  // --- NOVO: CÁLCULO DA VAZÃO ---
-  float elapsed_time = GetTime(); // Pega o tempo total desde o início da simulação
-  float throughput = 0;
-  // Evita divisão por zero no início e calcula a vazão
-  if (elapsed_time > 0.1f) // Usamos um pequeno limiar para estabilizar no início
+  sweep.configCount = (int)configs;
+  atomic_store(&sweep.nextConfig, 0);
+  sweep.rows = calloc(sweep.configCount, sizeof(*sweep.rows));
+  if (sweep.rows == NULL)
   {
-    throughput = (float)completed_messages_count / elapsed_time;
+    fprintf(stderr, "Sem memoria\n");
+    exit(1);
   }
 
-  // Exibe as estatísticas
-  DrawText(TextFormat("Msgs Concluidas: %d", completed_messages_count), statsArea.x + 10, statsArea.y + 40, 20, DARKGRAY);
-  DrawText(TextFormat("Latencia: %.2f ms", avg_latency_ms), statsArea.x + 10, statsArea.y + 70, 20, DARKGRAY);
-  DrawText(TextFormat("Timeouts: %d", total_retransmissions), statsArea.x + 10, statsArea.y + 100, 20, DARKGRAY);
+  if (jobs > sweep.configCount)
+    jobs = sweep.configCount;
+  fprintf(stderr, "Varredura: %d configuracoes em %d processos\n", sweep.configCount, jobs);
+  pthread_t *threads = GrowColumn(NULL, sizeof(*threads), jobs);
+  for (int j = 0; j < jobs; j++)
+    pthread_create(&threads[j], NULL, SweepWorker, NULL);
+  for (int j = 0; j < jobs; j++)
+    pthread_join(threads[j], NULL);
+  free(threads);
 
-  // --- NOVO: EXIBIÇÃO DA VAZÃO ---
-  DrawText(TextFormat("Vazao: %.2f msg/s", throughput), statsArea.x + 10, statsArea.y + 130, 20, DARKGRAY);
+  int failed = 0;
+  PrintCsvHeader();
+  for (int c = 0; c < sweep.configCount; c++)
+  {
+    if (sweep.rows[c] == NULL)
+      failed++;
+    else
+      printf("%s\n", sweep.rows[c]);
+    free(sweep.rows[c]);
+  }
+  free(sweep.rows);
+  return failed > 0 ? 1 : 0;
 }
 
 //====================================================================================
 // FUNÇÃO PRINCIPAL
 //====================================================================================
-int main(void)
+int main(int argc, char **argv)
 {
+  if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+    return RunHeadless(argc - 1, argv + 1);
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    return RunBenchmarks(argc - 1, argv + 1);
+  if (argc > 1 && strcmp(argv[1], "--sweep") == 0)
+    return RunSweep(argv[0], argc - 1, argv + 1);
+
   const int screenW = 1280, screenH = 720;
   InitWindow(screenW, screenH, "Simulador de Rede Avançado");
   SetTargetFPS(60);
   srand(time(NULL));
+  ResetScheduler();
+  LoadMessageSprite();
+  LoadTopologyLayer(screenW, screenH);
+  StartSimulationThread();
 
   int uiFromNode = 0, uiToNode = 13, uiMsgCount = 50;
-  bool sendPressed = false, burstInProgress = false;
-  int messagesToSend = 0, burstRoundsSent = 0;
-  float messageSendTimer = 0.0f, burstTimer = 0.0f;
-  int messageFromNode = -1, messageToNode = -1, nodeToConnect = -1;
-  const int TOTAL_BURST_ROUNDS = 10;
+  bool sendPressed = false;
+  int nodeToConnect = -1;
+  Camera2D camera = {.zoom = 1.0f};
 
   while (!WindowShouldClose())
   {
     Vector2 mouse = GetMousePosition();
-    float dt = GetFrameTime();
     Rectangle uiArea = {screenW - 220, 10, 210, 190};
+    const Snapshot *view = AcquireSnapshot();
+    UpdateSpatialIndex(view);
+    UpdateViewCamera(&camera, mouse);
+    Vector2 mouseWorld = GetScreenToWorld2D(mouse, camera);
+    Rectangle visible = VisibleWorldRect(camera, screenW, screenH);
+    FlushCommandBacklog();
 
     if (sendPressed)
     {
       sendPressed = false;
-      messagesToSend = uiMsgCount;
-      messageFromNode = uiFromNode;
-      messageToNode = uiToNode;
-      messageSendTimer = MESSAGE_INTERVAL;
-    }
-    if (messagesToSend > 0)
-    {
-      messageSendTimer += dt;
-      if (messageSendTimer >= MESSAGE_INTERVAL)
-      {
-        if (messageFromNode != messageToNode)
-          AddAsyncMessage(messageFromNode, messageToNode);
-        messagesToSend--;
-        messageSendTimer = 0.0f;
-      }
+      SendCommand((Command){.type = CMD_SEND_STREAM, .a = uiFromNode, .b = uiToNode, .count = uiMsgCount});
     }
 
-    UpdateAsyncMessages(dt, 0.1f);
-
     if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && !CheckCollisionPointRec(mouse, uiArea))
-    {
-      AddNode(mouse.x, mouse.y);
-      PushAction(ACTION_ADD_NODE, nodeCount - 1, -1);
-    }
+      SendCommand((Command){.type = CMD_ADD_NODE, .x = mouseWorld.x, .y = mouseWorld.y});
     if (IsMouseButtonPressed(MOUSE_RIGHT_BUTTON))
     {
-      int clickedNode = -1;
-      for (int i = 0; i < nodeCount; i++)
-        if (CheckCollisionPointCircle(mouse, (Vector2){nodes[i].x, nodes[i].y}, NODE_RADIUS))
-        {
-          clickedNode = i;
-          break;
-        }
+      int clickedNode = PickNode(view, mouseWorld);
       if (clickedNode != -1)
       {
         if (nodeToConnect == -1)
@@ -825,10 +5379,7 @@ int main(void)
         else
         {
           if (nodeToConnect != clickedNode)
-          {
-            ConnectNodes(nodeToConnect, clickedNode);
-            PushAction(ACTION_CONNECT_NODES, nodeToConnect, clickedNode);
-          }
+            SendCommand((Command){.type = CMD_CONNECT_NODES, .a = nodeToConnect, .b = clickedNode});
           nodeToConnect = -1;
         }
       }
@@ -839,52 +5390,50 @@ int main(void)
     }
 
     if (IsKeyPressed(KEY_Q))
-      CreateDefaultNetwork();
+      SendCommand((Command){.type = CMD_DEFAULT_NETWORK});
     if (IsKeyDown(KEY_LEFT_CONTROL) && IsKeyPressed(KEY_Z))
-      UndoAction();
+      SendCommand((Command){.type = CMD_UNDO});
     if (IsKeyPressed(KEY_W))
       nodeToConnect = -1;
     if (IsKeyPressed(KEY_P))
-      PrintNonCompletedMessages();
+      SendCommand((Command){.type = CMD_PRINT_STATUS});
     if (IsKeyPressed(KEY_B))
-    {
-      burstInProgress = true;
-      burstRoundsSent = 0;
-      burstTimer = 0.0f;
-    }
-
-    if (burstInProgress)
-    {
-      burstTimer += dt;
-      if (burstTimer >= MESSAGE_INTERVAL)
-      {
-        SendOneBurstRound();
-        burstRoundsSent++;
-        burstTimer = 0.0f;
-        if (burstRoundsSent >= TOTAL_BURST_ROUNDS)
-          burstInProgress = false;
-      }
-    }
+      SendCommand((Command){.type = CMD_START_BURST});
+    if (IsKeyPressed(KEY_U))
+      colorByUtilization = !colorByUtilization;
+    if (IsKeyPressed(KEY_T))
+      SendCommand((Command){.type = CMD_TOGGLE_TRACE});
+    if (IsKeyPressed(KEY_S))
+      SendCommand((Command){.type = CMD_SAVE_TOPOLOGY});
+    if (IsKeyPressed(KEY_L))
+      SendCommand((Command){.type = CMD_LOAD_TOPOLOGY});
 
+    UpdateTopologyLayer(view, camera, visible);
     BeginDrawing();
     ClearBackground(RAYWHITE);
     DrawNetwork();
-    DrawTravelingMessages();
-    DrawQueuedMessages();
+    BeginMode2D(camera);
+    DrawTravelingMessages(view, visible);
+    DrawQueuedMessages(view, visible);
+    if (nodeToConnect != -1 && nodeToConnect < view->nodeCount)
+      DrawLine(view->nodes[nodeToConnect].x, view->nodes[nodeToConnect].y, mouseWorld.x, mouseWorld.y, DARKGRAY);
+    EndMode2D();
     DrawUI(uiArea, &uiFromNode, &uiToNode, &uiMsgCount, &sendPressed);
-    DrawStatistics(screenW);
+    DrawStatistics(screenW, view);
     DrawText("ESQ: Adicionar | DIR: Conectar", 10, 10, 20, DARKGRAY);
-    DrawText("Q: Rede Padrao | W: Limpar | P: Status | B: Rajada", 10, 40, 20, DARKGRAY);
-    DrawText("CTRL+Z: Desfazer", 10, 70, 20, DARKGRAY);
+    DrawText("Q: Rede Padrao | W: Limpar | P: Status | B: Rajada | U: Uso | T: Trace", 10, 40, 20, DARKGRAY);
+    DrawText("CTRL+Z: Desfazer | Roda/Meio: Zoom/Mover | R: Recentrar | S/L: Salvar/Carregar", 10, 70, 20, DARKGRAY);
     if (nodeToConnect != -1)
     {
       char buffer[64];
       sprintf(buffer, "Conectar nó %d com...", nodeToConnect);
       DrawText(buffer, 10, 100, 20, RED);
-      DrawLine(nodes[nodeToConnect].x, nodes[nodeToConnect].y, mouse.x, mouse.y, DARKGRAY);
     }
     EndDrawing();
   }
+  StopSimulationThread();
+  UnloadTopologyLayer();
+  UnloadMessageSprite();
   CloseWindow();
   return 0;
 }
\ No newline at end of file